@@ -25,6 +25,8 @@
 // *****************************************************************************
 //
 
+#define _GNU_SOURCE           // syncfs() and renameat2() on Linux
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -33,21 +35,111 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <sys/file.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
-#define MAX_ROOMS 7           // Total rooms, <= number of names in roomNames[]
+#define DEFAULT_ROOMS 7       // Total rooms unless overridden with --rooms
+#define MIN_ROOMS 2           // Need at least a START and an END room
 #define MAX_PATH 14           // The most steps allowed
-#define MAX_ROOM_CHARS 15     // Max number of chars in room names
+#define MAX_ROOM_CHARS 30     // Max number of chars in room names (incl. NUL)
+#define MAX_INPUT_CHARS 256   // Max number of chars read from the user
+#define MAX_PATH_CHARS 4096   // Max number of chars in a Room file path
+#define MIN_ADJ 3             // Adjacent Rooms picked for each Room
+#define MAX_ADJ 6             // Default most adjacent Rooms per Room
+#define MAX_DEGREE_LIMIT 255  // Largest --max-degree accepted
+#define PARTNER_TRIES 32      // Random tries to find an extra connection
+
+#define BENCH_SEED 1          // Default seed for --bench, so runs compare
+#define BENCH_MOVES 1000000   // Moves resolved per --bench run
+#define BENCH_ROOMS "1000,10000,100000" // Default --bench-rooms
+#define BENCH_DEGREES "3-6,6-12"        // Default --bench-degrees
+#define MAX_THREADS 256       // Most worker threads used for one job
+#define SERVE_EVENTS 256      // Most socket events handled per epoll_wait()
+#define ANALYZE_BLOCK 4096    // Simulated games per random number stream
+#define ANALYZE_STREAM (1ULL << 40) // First stream for simulated games
+#define NAME_STREAM (1ULL << 41) // First stream for procedural Room names
+#define NAME_SPARSENESS 64    // Least ratio of possible names to Rooms
+#define BITSET_ROOMS 1024     // Most Rooms for a World to get adjBits[]
+#define HINT_NOT_ASKED (-2)   // jsonTurn() hint when there was no HINT
+#define JOURNAL_RING 65536    // Events the journal ring holds (a power of 2)
+#define JOURNAL_CHUNK 4096    // Most events encoded per journal write()
+#define JOURNAL_RECORD 21     // Most bytes one encoded event takes
+#define JOURNAL_POLL 1000     // Microseconds the journal writer sleeps idle
+#define JOURNAL_MAGIC "ADVJRNL" // Starts every run in a journal file
+#define JOURNAL_VERSION 1     // Bumped whenever the record layout changes
+
+#define MAX_SHARDS 4096       // Most subdirectories for --shards
+#define MANIFEST_NAME ".manifest" // Lists the Rooms of a sharded directory
+
+#define WORLD_MAGIC "ADVWRLD"  // First bytes of a binary world file
+#define WORLD_VERSION 3        // Bumped whenever the file layout changes
+#define GENERATOR_VERSION 2    // Bumped whenever the same GenParams start
+                               //   building a different World
+
+#define CHECKPOINT_MAGIC "ADVSAVE" // First bytes of a checkpoint file
+#define CHECKPOINT_VERSION 1   // Bumped whenever the checkpoint changes
+
+#define NO_DISTANCE (-1)       // endDist of a Room with no way to the END
+#define DIST_UNKNOWN (-2)      // endDist of a Room read from an old file
 
 
 enum roomType { START_ROOM, END_ROOM, MID_ROOM };   // Room classifications
 
+enum worldFormat { TEXT_FORMAT, BINARY_FORMAT };    // How a World is stored
+
+enum generator { CLASSIC_GENERATOR, CONNECTED_GENERATOR }; // How Rooms connect
+
+enum statsFormat { STATS_OFF, STATS_JSON, STATS_PROM };   // --stats output
+
+enum strategy { RANDOM_WALK, GREEDY_WALK, NUM_STRATEGIES }; // Simulated players
+
+enum protocol { TEXT_PROTOCOL, JSON_PROTOCOL };     // How games talk (--protocol)
+
+enum journalKind { JOURNAL_RUN, JOURNAL_START, JOURNAL_MOVE, JOURNAL_REJECT,
+                   JOURNAL_HINT, JOURNAL_WIN, JOURNAL_LOSE, JOURNAL_QUIT,
+                   NUM_JOURNAL_KINDS };        // Journal records (--journal)
+
+enum phase { MKDIR_PHASE, GENERATE_PHASE, WRITE_PHASE, LOAD_PHASE,
+             EXPORT_PHASE, PLAY_PHASE, NUM_PHASES };      // Timed phases
+
+
+// bitVec: Four 64-bit words of an adjacency bitset handled at once. GCC
+// turns operations on it into SIMD instructions where the machine has
+// them (two SSE2 or one AVX2 operation on x86-64) and into plain word
+// operations where it does not. Rows of adjBits[] are only 8 byte
+// aligned, and they are also read as plain words, hence aligned(8) and
+// may_alias.
+//
+typedef uint64_t bitVec __attribute__((vector_size(32), aligned(8), may_alias));
+
 
-// struct Room: Holds all the information needed for each room:
+// struct Room: Holds all the information needed for each room. Every
+// field is a fixed-width integer so an array of Rooms can be written to
+// a binary world file as-is and mapped straight back in (see
+// writeWorld() and mapWorld()).
 //
-// name   -> Name of the room
+// nameOff   -> Offset of the Room's name in the World's names[] string
+//              table.
 //
-// adj[]  -> Indicates which rooms connect to it: 0 = no, 1 = yes
-//           The indices of the array reference rooms in two ways:
+// adjStart  -> Offset of the Room's first adjacent Room in the World's
+//              adjList[] array.
+//
+// adjCount  -> Number of adjacent Rooms. The adjacent Rooms are stored
+//              in adjList[adjStart] through adjList[adjStart+adjCount-1].
+//              The values stored there are indices of Rooms in the
+//              World's rooms[] array. Those indices reference rooms in
+//              two ways:
 //
 //               1st: When setting up the room files, the indices
 //                    reflect the order in which the room data is
@@ -57,25 +149,392 @@ enum roomType { START_ROOM, END_ROOM, MID_ROOM };   // Room classifications
 //                    match the order in which the files were read from
 //                    the filesystem.
 //
-// type   -> The type of room (START, END, or MID)
+// type      -> The type of room (START, END, or MID)
+//
+// endDist   -> Fewest steps from this Room to an END ROOM (0 for the END
+//              ROOM itself), NO_DISTANCE if there is no way there, or
+//              DIST_UNKNOWN if the Room came from a file written before
+//              distances were kept (see computeDistances()).
 //
 struct Room {
-    char name[30];
-    int adj[MAX_ROOMS];
-    enum roomType type;
+    int32_t nameOff;
+    int32_t adjStart;
+    int32_t adjCount;
+    int32_t type;
+    int32_t endDist;
+};
+
+
+// struct Arena: One block of memory handed out front to back. A World
+// keeps everything it owns in a single Arena, so it is freed all at once
+// no matter how many Rooms it has.
+//
+// base      -> Start of the block, or NULL if there is none.
+//
+// size      -> Size of the block in bytes.
+//
+// used      -> Bytes handed out so far.
+//
+struct Arena {
+    char *base;
+    size_t size;
+    size_t used;
+};
+
+
+// struct NameSlot: One slot of a World's name index.
+//
+// room      -> Index of a Room in rooms[], or -1 if the slot is empty.
+//
+// hash      -> hashName() of the Room's name. A lookup only compares
+//              strings when the hashes agree, so stepping past the other
+//              names on a probe sequence is a single integer compare and
+//              never touches names[].
+//
+struct NameSlot {
+    int32_t room;
+    uint32_t hash;
+};
+
+
+// struct World: Holds every Room in the game plus the adjacency lists.
+//
+// numRooms  -> Number of Rooms in rooms[]. Set at runtime (see --rooms).
+//
+// rooms     -> Contiguous array of numRooms Room structs.
+//
+// adjList   -> Packed ("compressed sparse row") list of adjacent Rooms.
+//              Each Room owns one slice of it (see struct Room), so the
+//              whole array only holds as many entries as there are
+//              connections instead of numRooms * numRooms flags.
+//
+// numAdj    -> Number of entries in adjList[].
+//
+// names     -> String table holding every Room name, each one NUL
+//              terminated (see struct Room).
+//
+// namesSize -> Number of bytes in names[].
+//
+// map       -> When the World was mapped from a binary world file, the
+//              start of the mapping. rooms[], adjList[] and names[] then
+//              point into it rather than at separate allocations.
+//
+// mapSize   -> Size of the mapping in bytes.
+//
+// nameIndex -> Hash table used to look up Rooms by name (see
+//              buildNameIndex() and struct NameSlot).
+//
+// indexSize -> Number of slots in nameIndex[]. Always a power of 2.
+//
+// arena     -> Once a World is built (see packWorld()), rooms[],
+//              adjList[], names[] and nameIndex[] all live here, one
+//              after another. A mapped World only keeps nameIndex[] here.
+//              While a World is still being built its arrays are separate
+//              allocations and arena.base is NULL.
+//
+// lazy      -> Set for a World whose Rooms are read as they are reached
+//              (see readRoomsLazy()), NULL once everything is loaded.
+//              Such a World is never packed into its Arena.
+//
+// adjBits   -> For a World of at most BITSET_ROOMS Rooms, the same
+//              connections as adjList[] stored one bit per pair of Rooms:
+//              row i is bitWords words starting at adjBits[i * bitWords],
+//              with bit j set if Room j is adjacent to Room i. Lets
+//              moveRoom() check a move in one step and lets sets of
+//              neighbours be combined a whole word (or bitVec) at a time.
+//              Kept in the Arena (see buildAdjBits()); NULL for bigger
+//              Worlds and lazily loaded ones.
+//
+// bitWords  -> Words per row of adjBits[], a multiple of 4 so a row is
+//              a whole number of bitVecs. 0 when there is no adjBits[].
+//
+struct World {
+    int numRooms;
+    struct Room *rooms;
+    int32_t *adjList;
+    int numAdj;
+    char *names;
+    int namesSize;
+    void *map;
+    size_t mapSize;
+    struct NameSlot *nameIndex;
+    int indexSize;
+    struct Arena arena;
+    struct Lazy *lazy;
+    uint64_t *adjBits;
+    int bitWords;
+};
+
+
+// struct Stats: Instrumentation for one run, dumped on exit with --stats.
+// It is a global (like the journal below): the counters are bumped from
+// all over, including from worker threads, and threading a pointer
+// through every call just to count things isn't worth it. When --stats
+// is not given, format is STATS_OFF and every STAT_ADD() and phase timer
+// is a single well-predicted branch.
+//
+// format          -> How to dump the numbers, or STATS_OFF.
+//
+// outName         -> File to dump them to, or NULL for stderr.
+//
+// phaseSeconds[]  -> Time spent in each phase (see enum phase).
+//
+// The rest are counters of the work done: files opened, bytes read and
+// written through them, bytes mapped from world files, stat() calls,
+// directories created, directory entries read and moves processed.
+//
+struct Stats {
+    enum statsFormat format;
+    char *outName;
+    double phaseSeconds[NUM_PHASES];
+    long long filesOpened;
+    long long bytesRead;
+    long long bytesWritten;
+    long long bytesMapped;
+    long long statCalls;
+    long long dirsCreated;
+    long long dirEntries;
+    long long movesProcessed;
+};
+
+struct Stats stats = { STATS_OFF };
+
+// Add n to one of the stats counters. The add is atomic because Room
+// files are written from several threads at once.
+//
+#define STAT_ADD(counter, n)                                               \
+    do {                                                                   \
+        if(stats.format != STATS_OFF) {                                    \
+            __atomic_add_fetch(&stats.counter, (n), __ATOMIC_RELAXED);     \
+        }                                                                  \
+    } while(0)
+
+
+// struct JournalEvent: One thing that happened in a game, as queued by
+// the game loop for the journal writer.
+//
+// micros     -> When it happened, in microseconds of CLOCK_MONOTONIC.
+//
+// session    -> Number of the game in this run, from journalSession().
+//
+// room       -> The Room the event is about (see enum journalKind), or -1.
+//
+// kind       -> What happened (enum journalKind).
+//
+struct JournalEvent {
+    uint64_t micros;
+    uint32_t session;
+    int32_t room;
+    int32_t kind;
+};
+
+
+// struct Journal: The append-only journal of every game (--journal). It is
+// global for the same reason as stats: events come from every game loop.
+// The game loop only ever stores an event in ring[] and moves head on; a
+// writer thread encodes the events between tail and head and appends
+// them with one write() per JOURNAL_CHUNK. There is one game loop per
+// process, so ring[] has a single producer and a single consumer and
+// needs no lock. When journaling is off, fd is -1 and JOURNAL_EVENT() is
+// a single well-predicted branch.
+//
+// fd         -> The journal file, or -1.
+//
+// ring[]     -> JOURNAL_RING events waiting to be written.
+//
+// head       -> Events queued so far. Only the game loop moves it.
+//
+// tailSeen   -> tail as the game loop last read it. The game loop only
+//               reads tail again when ring[] looks full.
+//
+// tail       -> Events written so far. Only the writer moves it. It is
+//               kept on a cache line of its own, away from head.
+//
+// baseMicros -> CLOCK_MONOTONIC when the run began; the first event is
+//               timed from it, every later one from the one before.
+//
+// stop       -> Set by journalClose() to have the writer finish up.
+//
+// error      -> errno of a failed write, set by the writer as it gives
+//               up. journalEvent() and journalClose() report it.
+//
+// nextSession
+//            -> Number for the next game to start.
+//
+// waits      -> Times the game loop found ring[] full and had to wait.
+//
+struct Journal {
+    int fd;
+    struct JournalEvent *ring;
+    uint64_t head;
+    uint64_t tailSeen;
+    uint64_t tail __attribute__((aligned(64)));
+    uint64_t baseMicros __attribute__((aligned(64)));
+    int stop;
+    int error;
+    uint32_t nextSession;
+    long long waits;
+    pthread_t writer;
+};
+
+struct Journal journal = { .fd = -1 };
+
+// Queue one journal event, if there is a journal.
+//
+#define JOURNAL_EVENT(session, kind, room)                                 \
+    do {                                                                   \
+        if(journal.fd >= 0) {                                              \
+            journalEvent((session), (kind), (room));                      \
+        }                                                                  \
+    } while(0)
+
+
+// struct Path: Holds the rooms visited on the "path" to the END ROOM
+//
+// pathIDXs[]  -> Indices of world->rooms[] that map to rooms visited
+//                along the path.
+//
+// pathCount   -> Tracks how many Rooms were added to the Path
+//
+struct Path {
+    int pathIdxs[MAX_PATH];
+    int pathCount;
+};
+
+
+// struct GenParams: Everything that decides what a new World looks like
+// and how it gets built:
+//
+// numRooms   -> Number of Rooms to create.
+//
+// seed       -> Seed for the random number generator (see struct Rng).
+//               The same seed and number of Rooms always produce the
+//               same World.
+//
+// numThreads -> Number of worker threads used to build the World and
+//               write its Room files. Does not change the World itself.
+//
+// numShards  -> Number of hashed subdirectories the Room files are spread
+//               over (see shardOf()), or 0 to put them all directly in
+//               the output directory. Does not change the World itself.
+//
+// generator  -> CLASSIC_GENERATOR: every Room picks MIN_ADJ random Rooms
+//               to connect to. Quick, but the END ROOM may be out of
+//               reach and there is no limit on connections.
+//               CONNECTED_GENERATOR: a random spanning tree plus extra
+//               connections (see connectRooms()). Every Room can be
+//               reached and every Room has between minDegree and
+//               maxDegree connections.
+//
+// minDegree, maxDegree
+//            -> Bounds on the number of connections per Room for
+//               CONNECTED_GENERATOR.
+//
+struct GenParams {
+    int numRooms;
+    uint64_t seed;
+    int numThreads;
+    int numShards;
+    enum generator generator;
+    int minDegree;
+    int maxDegree;
+};
+
+
+// struct Rng: State of one xoshiro256** random number stream. Streams are
+// cheap to set up (see rngSeed()), so every Room gets one of its own and
+// the World gets one more for choices about the World as a whole.
+//
+struct Rng {
+    uint64_t s[4];
+};
+
+
+// struct WorldHeader: First thing in a binary world file. It is followed
+// by the sections it describes, each starting on an 8 byte boundary:
+//
+//    struct Room rooms[numRooms];
+//    int32_t     adjList[numAdj];
+//    char        names[namesSize];
+//
+// Everything is stored in the byte order of the machine that wrote it.
+//
+// magic        -> WORLD_MAGIC, identifies the file as a world file.
+//
+// version      -> WORLD_VERSION the file was written with.
+//
+// numRooms, numAdj, namesSize
+//              -> Same as in struct World.
+//
+// roomsOffset, adjOffset, namesOffset
+//              -> Offsets of the sections from the start of the file.
+//
+// key          -> worldKey() of the GenParams the World was built from,
+//                 or 0 if that is not known.
+//
+// checksum     -> worldChecksum() of the three sections, checked every
+//                 time the file is mapped.
+//
+struct WorldHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numRooms;
+    uint32_t numAdj;
+    uint32_t namesSize;
+    uint64_t roomsOffset;
+    uint64_t adjOffset;
+    uint64_t namesOffset;
+    uint64_t key;
+    uint64_t checksum;
+};
+
+
+// struct Checkpoint: A game in progress, as saved by saveCheckpoint().
+// It has a fixed size, so it is written with one write() and read back
+// with one read(). Room indices are only good for the World they came
+// from, which is why the World's id is kept too.
+//
+// magic      -> CHECKPOINT_MAGIC, identifies the file as a checkpoint.
+//
+// version    -> CHECKPOINT_VERSION the file was written with.
+//
+// worldId    -> worldChecksum() of the World being played.
+//
+// startRoom  -> Index of the START ROOM.
+//
+// currRoom   -> Index of the Room the player is in.
+//
+// pathCount  -> Steps taken so far.
+//
+// pathIdxs[] -> Rooms visited, as in struct Path.
+//
+struct Checkpoint {
+    char magic[8];
+    uint32_t version;
+    int32_t startRoom;
+    uint64_t worldId;
+    int32_t currRoom;
+    int32_t pathCount;
+    int32_t pathIdxs[MAX_PATH];
 };
 
 
 // *****************************************************************************
 // 
-// int setupRooms(struct Room *prooms[], char dirName[], char *roomNames[])
+// int setupRooms(struct World *world, struct GenParams *params,
+//                char outName[], char *roomNames[], enum worldFormat format)
 //
-//    Entry:   struct Room *prooms[]
-//                Pointer array containing all Room structs.
-//             char dirName[]
-//                Array containing the name of the file output directory.
-//             char *readRoomNames[]
-//                Pointer array containing all Room names read in from files.
+//    Entry:   struct World *world
+//                World to fill in.
+//             struct GenParams *params
+//                Size, seed and thread count for the new World.
+//             char outName[]
+//                Array containing the name of the file output directory
+//                (TEXT_FORMAT) or of the world file (BINARY_FORMAT).
+//             char *roomNames[]
+//                Pointer array containing the names available to Rooms.
+//             enum worldFormat format
+//                How to store the Rooms.
 //
 //    Exit:    Returns 0 for successful execution, 1 for error.
 //
@@ -83,119 +542,7597 @@ struct Room {
 //
 // *****************************************************************************
 //
-int setupRooms(struct Room *prooms[], char dirName[], char *roomNames[]);
+int setupRooms(struct World *world, struct GenParams *params,
+               char outName[], char *roomNames[], enum worldFormat format);
+
+
+// *****************************************************************************
+// 
+// int generateRooms(struct World *world, struct GenParams *params,
+//                   char *roomNames[])
+//
+//    Entry:   struct World *world
+//                World to fill in.
+//             struct GenParams *params
+//                Size, seed and thread count for the new World.
+//             char *roomNames[]
+//                Pointer array containing the names available to Rooms.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Create Rooms in memory, without writing them anywhere.
+//
+// *****************************************************************************
+//
+int generateRooms(struct World *world, struct GenParams *params,
+                  char *roomNames[]);
 
 
 // *****************************************************************************
 // 
-// int readRooms(struct Room *prooms[], char dirName[], char *readRoomNames[])
+// int writeRooms(struct World *world, char dirName[], int numThreads,
+//                int numShards)
 //
-//    Entry:   struct Room *prooms[]
-//                Pointer array containing all Room structs.
+//    Entry:   struct World *world
+//                World containing all Rooms.
 //             char dirName[]
 //                Array containing the name of the file output directory.
-//             char *readRoomNames[]
-//                Pointer array containing all Room names read in from files.
+//                It must be missing or empty, or be a Room directory
+//                written earlier (one with a manifest, or holding only
+//                Room files and shard subdirectories), which is then
+//                replaced. Any other directory is left alone.
+//             int numThreads
+//                Number of threads writing files at the same time.
+//             int numShards
+//                Number of hashed subdirectories to spread the files
+//                over, or 0 to write them all into dirName.
 //
 //    Exit:    Returns 0 for successful execution, 1 for error.
 //
-//    Purpose: Read Room data in from files.
+//    Purpose: Output one text file per Room. A sharded directory also
+//             gets a manifest (MANIFEST_NAME) listing every Room, so it
+//             can be loaded without scanning the subdirectories. The
+//             files are written into a staging directory, synced once
+//             and then renamed to dirName, so dirName never holds a half
+//             written World.
 //
 // *****************************************************************************
 //
-int readRooms(struct Room *prooms[], char dirName[], char *readRoomNames[]);
+int writeRooms(struct World *world, char dirName[], int numThreads,
+               int numShards);
 
 
 // *****************************************************************************
 // 
-// int playGame(struct Room *prooms[], char *readRoomNames[])
+// int shardOf(const char *name, int numShards)
 //
-//    Entry:   struct Room *prooms[]
-//                Pointer array containing all Room structs.
-//             char *readRoomNames[]
-//                Pointer array containing all Room names read in from files.
+//    Entry:   const char *name
+//                Name of a Room.
+//             int numShards
+//                Number of subdirectories the Room files are spread over.
+//                Must be > 0.
 //
-//    Exit:    Returns 0 for successful execution, 1 for error.
+//    Exit:    Returns the subdirectory (0 to numShards-1) that holds the
+//             Room's file.
 //
-//    Purpose: Perform the actual game functionality.
+//    Purpose: Pick a Room file's subdirectory from a hash of its name.
+//             Subdirectory n is named with printf("%03x", n).
 //
 // *****************************************************************************
 //
-int playGame(struct Room *prooms[], char *readRoomNames[]);
+int shardOf(const char *name, int numShards);
 
 
 // *****************************************************************************
 // 
-// void cleanRooms(struct Room *prooms[])
+// void rngSeed(struct Rng *rng, uint64_t seed, uint64_t stream)
 //
-//    Entry:   struct Room *prooms[] 
-//                Pointer array containing all Room structs.
+//    Entry:   struct Rng *rng
+//                Random number stream to set up.
+//             uint64_t seed
+//                Seed shared by all streams of one World.
+//             uint64_t stream
+//                Which of the World's streams this is (0 for the World
+//                itself, room+1 for a Room).
 //
 //    Exit:    None
 //
-//    Purpose: Free all pointers used in Room structs.
+//    Purpose: Start a random number stream.
 //
 // *****************************************************************************
 //
-void cleanRooms(struct Room *prooms[]); 
+void rngSeed(struct Rng *rng, uint64_t seed, uint64_t stream);
 
 
-int main() {
+// *****************************************************************************
+// 
+// uint64_t rngNext(struct Rng *rng)
+//
+//    Entry:   struct Rng *rng
+//                Random number stream to draw from.
+//
+//    Exit:    Returns the next 64 random bits from the stream.
+//
+//    Purpose: Draw a random number.
+//
+// *****************************************************************************
+//
+uint64_t rngNext(struct Rng *rng);
 
-    // Room names array. Static, but dynamically assigned to each room.
-    // There must be more names here than MAX_ROOMS!
-    //
-    char *roomNames[10] = {  
-        "Mozart",
-        "Schubert",
-        "Beethoven",
-        "Bach",
-        "Wagner",
-        "Vivaldi",
-        "Pachelbel",
-        "Satie",
-        "Berg",
-        "Chopin" };
 
-    // Array holding Room names read in from files (see readRooms()).
-    //
-    char *readRoomNames[MAX_ROOMS] = {0}; 
+// *****************************************************************************
+// 
+// uint32_t rngBounded(struct Rng *rng, uint32_t bound)
+//
+//    Entry:   struct Rng *rng
+//                Random number stream to draw from.
+//             uint32_t bound
+//                One more than the largest number wanted. Must be > 0.
+//
+//    Exit:    Returns a random number from 0 to bound-1, with every
+//             number equally likely.
+//
+//    Purpose: Draw a random number in a range without the bias of
+//             "rand() % bound".
+//
+// *****************************************************************************
+//
+uint32_t rngBounded(struct Rng *rng, uint32_t bound);
 
-    // Array of pointers to Rooms. This array is first used to set up
-    // Rooms to be output to files (see setupRooms()), then it is reused
-    // to read in Rooms from files (see readRooms()).
-    //
-    struct Room *prooms[MAX_ROOMS];
 
-    // Holds the name of the output file directory.
-    //
-    char dirName[30];       
+// *****************************************************************************
+// 
+// void runWorkers(void *(*work)(void *), void *tasks, size_t taskSize,
+//                 int numTasks)
+//
+//    Entry:   void *(*work)(void *)
+//                Function each worker thread runs.
+//             void *tasks
+//                Array of numTasks task structs, one handed to each
+//                worker.
+//             size_t taskSize
+//                Size of one task struct.
+//             int numTasks
+//                Number of worker threads to run.
+//
+//    Exit:    None. Returns once every worker has finished.
+//
+//    Purpose: Run a job on several threads at once.
+//
+// *****************************************************************************
+//
+void runWorkers(void *(*work)(void *), void *tasks, size_t taskSize,
+                int numTasks);
 
-    // Create the output file directory. The name is hardcoded to include
-    // my ONID username (ratclier), then ".rooms.", then the PID of the
-    // running program. This directory is not removed at the end of the
-    // game, per assignment guidelines.
-    //
-    sprintf(dirName, "%s.%ld", "ratclier.rooms", (long) getpid());
-    mkdir(dirName, 0755); // File permissions: u = rwx, g = r-x, o = r-x
-                          //                       421      4-1      4-1
-                          //                        7        5        5
 
-    // Set up the Room files.
-    //
-    setupRooms(prooms, dirName, roomNames);
+// *****************************************************************************
+// 
+// int writeWorld(struct World *world, char fileName[], uint64_t key)
+//
+//    Entry:   struct World *world
+//                World containing all Rooms.
+//             char fileName[]
+//                Array containing the name of the world file.
+//             uint64_t key
+//                worldKey() of the GenParams the World was built from, or
+//                0 if it was not built from GenParams.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Output the whole World to a single binary world file. The
+//             file is written under a temporary name, synced and renamed
+//             to fileName, so fileName is always a whole world file.
+//
+// *****************************************************************************
+//
+int writeWorld(struct World *world, char fileName[], uint64_t key);
 
-    // Read the Room data in from files.
-    //
-    readRooms(prooms, dirName, readRoomNames);
 
-    // Play the game.
-    //
-    playGame(prooms, readRoomNames);
+// *****************************************************************************
+// 
+// int mapWorld(struct World *world, char fileName[])
+//
+//    Entry:   struct World *world
+//                World to point at the mapped Rooms.
+//             char fileName[]
+//                Array containing the name of the world file.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Map a binary world file into memory. The Rooms are used
+//             in place, so there is nothing to parse. The file is only
+//             accepted if its checksum matches.
+//
+// *****************************************************************************
+//
+int mapWorld(struct World *world, char fileName[]);
+
+
+// *****************************************************************************
+// 
+// uint64_t worldKey(struct GenParams *params)
+//
+//    Entry:   struct GenParams *params
+//                How a World is to be built.
+//
+//    Exit:    Returns a 64-bit hash of everything in params that changes
+//             the World (not numThreads or numShards), plus
+//             GENERATOR_VERSION and WORLD_VERSION.
+//
+//    Purpose: Name a World by how it was built, so the same parameters
+//             always find the same cached world file.
+//
+// *****************************************************************************
+//
+uint64_t worldKey(struct GenParams *params);
+
+
+// *****************************************************************************
+// 
+// int loadCachedWorld(struct World *world, struct GenParams *params,
+//                     char cacheDir[], char *roomNames[])
+//
+//    Entry:   struct World *world
+//                World to fill in.
+//             struct GenParams *params
+//                How the World is to be built.
+//             char cacheDir[]
+//                Directory of cached world files, created if need be.
+//             char *roomNames[]
+//                Pointer array containing the names available to Rooms.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Map the world file for params from the cache. Only if it
+//             is missing or damaged is the World built and written there
+//             (under a temporary name first, then renamed into place so
+//             other runs never see half a file).
+//
+// *****************************************************************************
+//
+int loadCachedWorld(struct World *world, struct GenParams *params,
+                    char cacheDir[], char *roomNames[]);
+
+
+// *****************************************************************************
+// 
+// char *roomName(struct World *world, int room)
+//
+//    Entry:   struct World *world
+//                World containing all Rooms.
+//             int room
+//                Index of the Room in world->rooms[].
+//
+//    Exit:    Returns the Room's name.
+//
+//    Purpose: Look up a Room's name in the World's string table.
+//
+// *****************************************************************************
+//
+char *roomName(struct World *world, int room);
+
+
+// *****************************************************************************
+// 
+// int readRooms(struct World *world, char dirName[], int numThreads)
+//
+//    Entry:   struct World *world
+//                World to fill in with the Rooms read from files.
+//             char dirName[]
+//                Array containing the name of the file output directory.
+//             int numThreads
+//                Number of threads parsing Room files at the same time.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Read Room data in from files. If the directory has a
+//             manifest (see writeRooms()) the Rooms are taken from it
+//             and their files from the hashed subdirectories; otherwise
+//             every regular file not starting with "." is a Room. A
+//             directory with no Rooms, or no START ROOM, is an error.
+//
+// *****************************************************************************
+//
+int readRooms(struct World *world, char dirName[], int numThreads);
+
+
+// *****************************************************************************
+// 
+// int readRoomsLazy(struct World *world, char dirName[])
+//
+//    Entry:   struct World *world
+//                World to set up for the Rooms in dirName.
+//             char dirName[]
+//                Array containing the name of the file output directory.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Get a text World ready to play without reading its Room
+//             files. Only the names are learned up front; each Room is
+//             read the first time loadRoom() is called for it, and a
+//             background thread reads the neighbours of the Room named
+//             with prefetchRooms() ahead of time. Without a manifest,
+//             Rooms are read in order until the START ROOM is found. A
+//             directory with no Rooms, or no START ROOM, is an error.
+//
+// *****************************************************************************
+//
+int readRoomsLazy(struct World *world, char dirName[]);
+
+
+// *****************************************************************************
+// 
+// void loadRoom(struct World *world, int room)
+//
+//    Entry:   struct World *world
+//                World containing all Rooms.
+//             int room
+//                Index of the Room the player is entering.
+//
+//    Exit:    None
+//
+//    Purpose: Make sure a Room's type and connections can be used. Does
+//             nothing unless the World came from readRoomsLazy(); waits
+//             if the prefetcher is already reading the Room.
+//
+// *****************************************************************************
+//
+void loadRoom(struct World *world, int room);
+
+
+// *****************************************************************************
+// 
+// void prefetchRooms(struct World *world, int room)
+//
+//    Entry:   struct World *world
+//                World containing all Rooms.
+//             int room
+//                Index of the Room the player is in. It must be loaded.
+//
+//    Exit:    None
+//
+//    Purpose: Have the prefetcher start reading the Room's neighbours,
+//             dropping any earlier request. Does nothing unless the World
+//             came from readRoomsLazy().
+//
+// *****************************************************************************
+//
+void prefetchRooms(struct World *world, int room);
+
+
+// *****************************************************************************
+// 
+// int saveCheckpoint(char fileName[], uint64_t worldId, int startRoom,
+//                    int currRoom, struct Path *path)
+//
+//    Entry:   char fileName[]
+//                Array containing the name of the checkpoint file.
+//             uint64_t worldId
+//                worldChecksum() of the World being played.
+//             int startRoom
+//                Index of the START ROOM.
+//             int currRoom
+//                Index of the Room the player is in.
+//             struct Path *path
+//                Rooms visited so far.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Save a game in progress as a struct Checkpoint. The file
+//             is written under a temporary name, synced and renamed to
+//             fileName, so an earlier checkpoint is only ever replaced
+//             by a whole new one.
+//
+// *****************************************************************************
+//
+int saveCheckpoint(char fileName[], uint64_t worldId, int startRoom,
+                   int currRoom, struct Path *path);
+
+
+// *****************************************************************************
+// 
+// int loadCheckpoint(struct World *world, char fileName[],
+//                    uint64_t worldId, int startRoom, int *currRoom,
+//                    struct Path *path)
+//
+//    Entry:   struct World *world
+//                World the game is played on.
+//             char fileName[]
+//                Array containing the name of the checkpoint file.
+//             uint64_t worldId
+//                worldChecksum() of world.
+//             int startRoom
+//                Index of the START ROOM.
+//             int *currRoom
+//                Set to the Room the player was in.
+//             struct Path *path
+//                Set to the Rooms visited before the checkpoint.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Pick up a game saved by saveCheckpoint(). The checkpoint
+//             is refused if it was saved on another World, and its path
+//             is walked again by the normal movement rule, so a damaged
+//             file can not put the player somewhere they could not be.
+//
+// *****************************************************************************
+//
+int loadCheckpoint(struct World *world, char fileName[], uint64_t worldId,
+                   int startRoom, int *currRoom, struct Path *path);
+
+
+// *****************************************************************************
+// 
+// int playGame(struct World *world, char saveName[], char resumeName[])
+//
+//    Entry:   struct World *world
+//                World containing all Rooms read in from files.
+//             char saveName[]
+//                Checkpoint file written when the player types SAVE or
+//                the program gets SIGTERM, or NULL for none.
+//             char resumeName[]
+//                Checkpoint file to pick the game up from, or NULL to
+//                start in the START ROOM.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Perform the actual game functionality.
+//
+// *****************************************************************************
+//
+int playGame(struct World *world, char saveName[], char resumeName[]);
+
+
+// *****************************************************************************
+// 
+// int playProtocol(struct World *world, char saveName[],
+//                  char resumeName[])
+//
+//    Entry:   struct World *world
+//                World containing all Rooms.
+//             char saveName[]
+//                Checkpoint file written on SAVE or SIGTERM, or NULL.
+//             char resumeName[]
+//                Checkpoint file to pick the game up from, or NULL.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Play one game on stdin and stdout for a program rather than
+//             a person (--protocol json). Each turn is answered with one
+//             line of JSON (see jsonTurn()), written with a single
+//             write(). Each line of input is a Room index, a Room name,
+//             HINT or SAVE.
+//
+// *****************************************************************************
+//
+int playProtocol(struct World *world, char saveName[], char resumeName[]);
+
+
+// *****************************************************************************
+// 
+// int playBatch(struct World *world, char fileName[])
+//
+//    Entry:   struct World *world
+//                World containing all Rooms.
+//             char fileName[]
+//                File of scripted sessions, or "-" for stdin. Each line
+//                is one session: the Room names to move to, in order,
+//                separated by spaces or commas.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Replay scripted sessions with no prompts, using the same
+//             rules as playGame(). Prints one result line per session
+//             to stdout and the throughput to stderr.
+//
+// *****************************************************************************
+//
+int playBatch(struct World *world, char fileName[]);
+
+
+// *****************************************************************************
+// 
+// int serveGames(struct World *world, char sockName[],
+//                enum protocol protocol)
+//
+//    Entry:   struct World *world
+//                World containing all Rooms. It is only read, so every
+//                game shares it.
+//             char sockName[]
+//                Path of the Unix domain socket to listen on. Anything
+//                already there is replaced.
+//             enum protocol protocol
+//                TEXT_PROTOCOL: each connection gets exactly what
+//                playGame() would show and sends one Room name per line.
+//                JSON_PROTOCOL: each connection talks like
+//                playProtocol().
+//
+//    Exit:    Returns 0 once stopped by SIGINT or SIGTERM, 1 for error.
+//
+//    Purpose: Play many games at once, one per connection, from a single
+//             epoll event loop. Only available on Linux.
+//
+// *****************************************************************************
+//
+int serveGames(struct World *world, char sockName[], enum protocol protocol);
+
+
+// *****************************************************************************
+// 
+// int runBenchmark(struct GenParams *params, char *roomNames[],
+//                  char roomList[], char degreeList[], int json)
+//
+//    Entry:   struct GenParams *params
+//                Seed, thread count and generator to use. The room count
+//                and degree bounds are swept instead.
+//             char *roomNames[]
+//                Pointer array containing the names available to Rooms.
+//             char roomList[]
+//                Comma separated room counts to sweep, e.g. "1000,10000".
+//             char degreeList[]
+//                Comma separated min-max degree bounds to sweep, e.g.
+//                "3-6,6-12".
+//             int json
+//                1 to print results as JSON, 0 for CSV.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Time generating, writing, loading and playing Worlds of
+//             each size, density and storage format, and print one
+//             result row per combination.
+//
+// *****************************************************************************
+//
+int runBenchmark(struct GenParams *params, char *roomNames[],
+                 char roomList[], char degreeList[], int json);
+
+
+// *****************************************************************************
+// 
+// int runAnalysis(struct GenParams *params, char *roomNames[],
+//                 struct World *world, long long players, int numWorlds)
+//
+//    Entry:   struct GenParams *params
+//                How to build the Worlds, and how many threads to use.
+//             char *roomNames[]
+//                Array containing the names of all possible Rooms.
+//             struct World *world
+//                World to analyze, or NULL to build numWorlds of them
+//                with seeds params->seed, params->seed+1, ...
+//             long long players
+//                Games to simulate per World and strategy.
+//             int numWorlds
+//                Number of Worlds to build (or times to analyze world).
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Estimate how hard Worlds are. Simulated players follow the
+//             playGame() rules, either moving at random (RANDOM_WALK) or
+//             preferring Rooms they have not seen (GREEDY_WALK). The win
+//             rates, their spread over the Worlds and a histogram of
+//             winning path lengths are printed.
+//
+// *****************************************************************************
+//
+int runAnalysis(struct GenParams *params, char *roomNames[],
+                struct World *world, long long players, int numWorlds);
+
+
+// *****************************************************************************
+// 
+// int removeWorld(char worldName[])
+//
+//    Entry:   char worldName[]
+//                Room file directory or binary world file to remove.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Delete a World from disk.
+//
+// *****************************************************************************
+//
+int removeWorld(char worldName[]);
+
+
+// *****************************************************************************
+// 
+// double nowSeconds(void)
+//
+//    Entry:   None
+//
+//    Exit:    Returns the time in seconds on the monotonic clock.
+//
+//    Purpose: Time how long things take. Only differences between two
+//             calls mean anything.
+//
+// *****************************************************************************
+//
+double nowSeconds(void);
+
+
+// *****************************************************************************
+// 
+// double statsStart(void)
+//
+//    Entry:   None
+//
+//    Exit:    Returns the time to hand to statsStop() (0 when --stats is
+//             off, so the clock is not even read).
+//
+//    Purpose: Start timing a phase.
+//
+// *****************************************************************************
+//
+double statsStart(void);
+
+
+// *****************************************************************************
+// 
+// void statsStop(enum phase phase, double start)
+//
+//    Entry:   enum phase phase
+//                Phase being timed.
+//             double start
+//                What statsStart() returned when the phase began.
+//
+//    Exit:    None
+//
+//    Purpose: Add the time since start to the phase's total.
+//
+// *****************************************************************************
+//
+void statsStop(enum phase phase, double start);
+
+
+// *****************************************************************************
+// 
+// void dumpStats(void)
+//
+//    Entry:   None
+//
+//    Exit:    None
+//
+//    Purpose: Write out the phase timings and counters as JSON or in the
+//             Prometheus text format. Registered with atexit() so it runs
+//             however the program ends.
+//
+// *****************************************************************************
+//
+void dumpStats(void);
+
+
+// *****************************************************************************
+// 
+// int journalOpen(char fileName[], int numRooms)
+//
+//    Entry:   char fileName[]
+//                Array containing the name of the journal file. It is
+//                created if need be, and only ever appended to.
+//             int numRooms
+//                Number of Rooms in the World being played.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Start journaling: lock the file against other runs, append
+//             a run header and start the writer thread.
+//
+// *****************************************************************************
+//
+int journalOpen(char fileName[], int numRooms);
+
+
+// *****************************************************************************
+// 
+// uint32_t journalSession(void)
+//
+//    Entry:   None
+//
+//    Exit:    Returns the number of a new game, or 0 with no journal.
+//
+//    Purpose: Number a game for its journal events.
+//
+// *****************************************************************************
+//
+uint32_t journalSession(void);
+
+
+// *****************************************************************************
+// 
+// void journalEvent(uint32_t session, enum journalKind kind, int room)
+//
+//    Entry:   uint32_t session
+//                Number of the game, from journalSession().
+//             enum journalKind kind
+//                What happened.
+//             int room
+//                The Room it happened in or led to, or -1.
+//
+//    Exit:    None
+//
+//    Purpose: Queue one event for the journal writer. Only waits if the
+//             writer has fallen JOURNAL_RING events behind. Ends the
+//             program if the writer has failed. Called through
+//             JOURNAL_EVENT().
+//
+// *****************************************************************************
+//
+void journalEvent(uint32_t session, enum journalKind kind, int room);
+
+
+// *****************************************************************************
+// 
+// void journalClose(void)
+//
+//    Entry:   None
+//
+//    Exit:    None
+//
+//    Purpose: Write out every queued event and stop the writer thread,
+//             then report a write the writer failed. Registered with
+//             atexit() so it runs however the program ends.
+//
+// *****************************************************************************
+//
+void journalClose(void);
+
+
+// *****************************************************************************
+// 
+// int readJournal(char fileName[])
+//
+//    Entry:   char fileName[]
+//                Array containing the name of the journal file.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Decode a journal and print what it holds: each run, then
+//             totals for sessions, moves and how the games went
+//             (--journal-read).
+//
+// *****************************************************************************
+//
+int readJournal(char fileName[]);
+
+
+// *****************************************************************************
+// 
+// int findStartRoom(struct World *world)
+//
+//    Entry:   struct World *world
+//                World containing all Rooms.
+//
+//    Exit:    Returns the index of the START_ROOM, or -1 if there is
+//             none.
+//
+//    Purpose: Find where every game begins.
+//
+// *****************************************************************************
+//
+int findStartRoom(struct World *world);
+
+
+// *****************************************************************************
+// 
+// int moveRoom(struct World *world, int currRoom, char name[])
+//
+//    Entry:   struct World *world
+//                World containing all Rooms.
+//             int currRoom
+//                Index of the Room the player is in.
+//             char name[]
+//                Name of the Room the player wants to move to.
+//
+//    Exit:    Returns the index of the Room moved to, or -1 if there is
+//             no such Room or it is not adjacent to currRoom.
+//
+//    Purpose: Apply the game's movement rule to one move.
+//
+// *****************************************************************************
+//
+int moveRoom(struct World *world, int currRoom, char name[]);
+
+
+// *****************************************************************************
+// 
+// int moveRoomIndex(struct World *world, int currRoom, int room)
+//
+//    Entry:   struct World *world
+//                World containing all Rooms.
+//             int currRoom
+//                Index of the Room the player is in.
+//             int room
+//                Index of the Room the player wants to move to.
+//
+//    Exit:    Returns room, or -1 if there is no such Room or it is not
+//             adjacent to currRoom.
+//
+//    Purpose: Apply the game's movement rule to a move given by index,
+//             with no name to look up.
+//
+// *****************************************************************************
+//
+int moveRoomIndex(struct World *world, int currRoom, int room);
+
+
+// *****************************************************************************
+// 
+// int computeDistances(struct World *world)
+//
+//    Entry:   struct World *world
+//                World whose Rooms and adjList[] are complete.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Fill in every Room's endDist with one breadth-first search
+//             that starts from all the END ROOMs at once and follows the
+//             connections backward, so it costs the number of Rooms plus
+//             the number of connections no matter how many Rooms there
+//             are.
+//
+// *****************************************************************************
+//
+int computeDistances(struct World *world);
+
+
+// *****************************************************************************
+// 
+// int bestMove(struct World *world, int currRoom)
+//
+//    Entry:   struct World *world
+//                World containing all Rooms.
+//             int currRoom
+//                Index of the Room the player is in.
+//
+//    Exit:    Returns the index of the adjacent Room closest to an END
+//             ROOM, or -1 if no adjacent Room leads to one (or the
+//             distances are not known).
+//
+//    Purpose: Answer the HINT command in a constant number of steps per
+//             connection, using the distances kept with the World.
+//
+// *****************************************************************************
+//
+int bestMove(struct World *world, int currRoom);
+
+
+// *****************************************************************************
+// 
+// void cleanRooms(struct World *world)
+//
+//    Entry:   struct World *world
+//                World containing all Rooms.
+//
+//    Exit:    None
+//
+//    Purpose: Free (or unmap) all memory used by the World's Rooms.
+//
+// *****************************************************************************
+//
+void cleanRooms(struct World *world); 
+
+
+// *****************************************************************************
+// 
+// int buildAdjacency(struct World *world, int edgeFrom[], int edgeTo[],
+//                    int numEdges)
+//
+//    Entry:   struct World *world
+//                World whose Rooms get the adjacency lists.
+//             int edgeFrom[], int edgeTo[]
+//                Two-way connections between Rooms edgeFrom[i] and
+//                edgeTo[i]. Duplicates are allowed.
+//             int numEdges
+//                Number of entries in edgeFrom[] and edgeTo[].
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Pack the connections into the World's adjList[], one
+//             sorted slice per Room with duplicates removed.
+//
+// *****************************************************************************
+//
+int buildAdjacency(struct World *world, int edgeFrom[], int edgeTo[],
+                   int numEdges);
+
+
+// *****************************************************************************
+// 
+// int nameIndexSlots(int numRooms)
+//
+//    Entry:   int numRooms
+//                Number of Rooms in the World.
+//
+//    Exit:    Returns the number of nameIndex[] slots to use.
+//
+//    Purpose: Size the name index: a power of 2 that keeps the table at
+//             most half full.
+//
+// *****************************************************************************
+//
+int nameIndexSlots(int numRooms);
+
+
+// *****************************************************************************
+// 
+// int adjBitsWords(int numRooms)
+//
+//    Entry:   int numRooms
+//                Number of Rooms in the World.
+//
+//    Exit:    Returns the number of words in each row of adjBits[], or 0
+//             if the World is too big to get one.
+//
+//    Purpose: Size the adjacency bitset. It takes numRooms * numRooms
+//             bits, which only beats adjList[] for a few Rooms, so it is
+//             kept alongside adjList[] rather than instead of it, and
+//             only up to BITSET_ROOMS Rooms (128 KB).
+//
+// *****************************************************************************
+//
+int adjBitsWords(int numRooms);
+
+
+// *****************************************************************************
+// 
+// int buildAdjBits(struct World *world)
+//
+//    Entry:   struct World *world
+//                World whose adjList[] is complete and whose Arena still
+//                has room for the bitset (see adjBitsWords()).
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Build adjBits[] from adjList[] for a small World. Bigger
+//             Worlds are left without one.
+//
+// *****************************************************************************
+//
+int buildAdjBits(struct World *world);
+
+
+// *****************************************************************************
+// 
+// int packWorld(struct World *world)
+//
+//    Entry:   struct World *world
+//                Fully built World whose arrays are separate allocations.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Move the Rooms, adjacency list, string table and name
+//             index into one Arena sized to fit them exactly, in that
+//             order, and free the separate allocations.
+//
+// *****************************************************************************
+//
+int packWorld(struct World *world);
+
+
+// *****************************************************************************
+// 
+// int arenaInit(struct Arena *arena, size_t size)
+//
+//    Entry:   struct Arena *arena
+//                Arena to set up.
+//             size_t size
+//                Bytes to allocate for it.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Allocate an Arena's block.
+//
+// *****************************************************************************
+//
+int arenaInit(struct Arena *arena, size_t size);
+
+
+// *****************************************************************************
+// 
+// void *arenaAlloc(struct Arena *arena, size_t size)
+//
+//    Entry:   struct Arena *arena
+//                Arena to allocate from.
+//             size_t size
+//                Bytes wanted.
+//
+//    Exit:    Returns the memory (8 byte aligned), or NULL if the Arena
+//             is out of space.
+//
+//    Purpose: Hand out the next piece of an Arena.
+//
+// *****************************************************************************
+//
+void *arenaAlloc(struct Arena *arena, size_t size);
+
+
+// *****************************************************************************
+// 
+// void arenaFree(struct Arena *arena)
+//
+//    Entry:   struct Arena *arena
+//                Arena to free.
+//
+//    Exit:    None
+//
+//    Purpose: Free everything handed out from an Arena in one go.
+//
+// *****************************************************************************
+//
+void arenaFree(struct Arena *arena);
+
+
+// *****************************************************************************
+// 
+// int buildNameIndex(struct World *world)
+//
+//    Entry:   struct World *world
+//                World containing all Rooms and their names.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Build the hash table that findRoom() uses to turn a name
+//             into a Room index. It comes out of the World's Arena if it
+//             has one.
+//
+// *****************************************************************************
+//
+int buildNameIndex(struct World *world);
+
+
+// *****************************************************************************
+// 
+// int connectRooms(struct World *world, struct GenParams *params,
+//                  struct Rng *rng)
+//
+//    Entry:   struct World *world
+//                World whose Rooms get connected.
+//             struct GenParams *params
+//                Holds the bounds on connections per Room.
+//             struct Rng *rng
+//                Random number stream to draw from.
+//
+//    Exit:    Returns 0 for successful execution, 1 for error.
+//
+//    Purpose: Connect the Rooms so that every Room can be reached from
+//             every other one, with minDegree to maxDegree connections
+//             per Room. Runs in time proportional to Rooms plus
+//             connections.
+//
+// *****************************************************************************
+//
+int connectRooms(struct World *world, struct GenParams *params,
+                 struct Rng *rng);
+
+
+// *****************************************************************************
+// 
+// int findRoom(struct World *world, char name[])
+//
+//    Entry:   struct World *world
+//                World containing all Rooms. buildNameIndex() must have
+//                been run on it.
+//             char name[]
+//                Name of the Room to look up.
+//
+//    Exit:    Returns the index of the Room in world->rooms[], or -1 if
+//             there is no Room with that name.
+//
+//    Purpose: Look up a Room by name.
+//
+// *****************************************************************************
+//
+int findRoom(struct World *world, char name[]);
+
+
+// *****************************************************************************
+// 
+// int findRoomLen(struct World *world, const char *name, int len)
+//
+//    Entry:   struct World *world
+//                World containing all Rooms. buildNameIndex() must have
+//                been run on it.
+//             const char *name
+//                Name of the Room to look up. It does not need to be
+//                null terminated.
+//             int len
+//                Number of characters in the name.
+//
+//    Exit:    Returns the index of the Room in world->rooms[], or -1 if
+//             there is no Room with that name.
+//
+//    Purpose: Look up a Room by a name that is a slice of a larger
+//             buffer, without copying it out first.
+//
+// *****************************************************************************
+//
+int findRoomLen(struct World *world, const char *name, int len);
+
+
+// *****************************************************************************
+// 
+// void printUsage(char *progName)
+//
+//    Entry:   char *progName
+//                Name the program was run as (argv[0]).
+//
+//    Exit:    None
+//
+//    Purpose: Print the command line options.
+//
+// *****************************************************************************
+//
+void printUsage(char *progName);
+
+
+int main(int argc, char *argv[]) {
+
+    // Room names array. Static, but dynamically assigned to each room.
+    // When there are more Rooms than names here, the Rooms get made up
+    // names instead (see makeName()).
+    //
+    char *roomNames[10] = {  
+        "Mozart",
+        "Schubert",
+        "Beethoven",
+        "Bach",
+        "Wagner",
+        "Vivaldi",
+        "Pachelbel",
+        "Satie",
+        "Berg",
+        "Chopin" };
+
+    // The World holding all Rooms. It is first used to set up Rooms to
+    // be output to files (see setupRooms()), then it is reused to read in
+    // Rooms from files (see readRooms()).
+    //
+    struct World world = {0};
+
+    // Holds the name of the output file directory (or world file).
+    //
+    char dirName[MAX_PATH_CHARS];
+
+    int opt;                // option returned by getopt_long()
+    long numRooms;          // number of Rooms requested with --rooms
+    long numThreads;        // number of threads requested with --threads
+    int seedSet = 0;        // 1 once --seed has been given
+
+    char *endPtr;           // first character strtoull() did not convert
+
+    struct GenParams params; // how to build a new World
+
+    enum worldFormat format = TEXT_FORMAT; // how to store a new World
+    char *loadName = NULL;  // existing World to play (--load)
+    char *exportName = NULL; // directory to export the World to (--export)
+    char *batchName = NULL; // scripted sessions to replay (--batch)
+    char *serveName = NULL; // socket to serve games on (--serve)
+    char *cacheName = NULL; // directory of cached worlds (--cache)
+    char *saveName = NULL;  // checkpoint file to save to (--checkpoint)
+    char *resumeName = NULL; // checkpoint file to resume (--resume)
+    char *journalName = NULL; // journal to append games to (--journal)
+    char *journalRead = NULL; // journal to decode (--journal-read)
+    int cached = 0;         // 1 once the World is mapped from the cache
+    enum protocol protocol = TEXT_PROTOCOL; // how games talk (--protocol)
+    int lazy = 0;           // 1 to read Room files as they are reached
+
+    int bench = 0;          // 1 to run the benchmark (--bench)
+    long long analyzePlayers = 0; // games per World to simulate (--analyze)
+    long numWorlds = 1;     // Worlds to build and analyze (--worlds)
+    int benchJson = 0;      // 1 for JSON benchmark results (--bench-json)
+    char *benchRooms = BENCH_ROOMS;     // room counts to sweep
+    char *benchDegrees = BENCH_DEGREES; // degree bounds to sweep
+
+    struct stat loadStat;   // stat() information on the --load World
+
+    double phaseStart;      // when the phase being timed began
+
+    // Command line options.
+    //
+    static struct option longOpts[] = {
+        { "rooms",  required_argument, NULL, 'r' },
+        { "format", required_argument, NULL, 'f' },
+        { "load",   required_argument, NULL, 'l' },
+        { "export", required_argument, NULL, 'e' },
+        { "threads", required_argument, NULL, 't' },
+        { "shards", required_argument, NULL, 'd' },
+        { "lazy",   no_argument,       NULL, 'L' },
+        { "seed",   required_argument, NULL, 's' },
+        { "generator", required_argument, NULL, 'g' },
+        { "min-degree", required_argument, NULL, 'm' },
+        { "max-degree", required_argument, NULL, 'M' },
+        { "batch",  required_argument, NULL, 'b' },
+        { "serve",  required_argument, NULL, 'u' },
+        { "protocol", required_argument, NULL, 'P' },
+        { "cache",  required_argument, NULL, 'C' },
+        { "checkpoint", required_argument, NULL, 'k' },
+        { "resume", required_argument, NULL, 'K' },
+        { "journal", required_argument, NULL, 'j' },
+        { "journal-read", required_argument, NULL, 'x' },
+        { "analyze", required_argument, NULL, 'a' },
+        { "worlds", required_argument, NULL, 'w' },
+        { "bench",  no_argument,       NULL, 'B' },
+        { "bench-rooms", required_argument, NULL, 'R' },
+        { "bench-degrees", required_argument, NULL, 'D' },
+        { "bench-json", no_argument,   NULL, 'J' },
+        { "stats",  required_argument, NULL, 'S' },
+        { "stats-file", required_argument, NULL, 'F' },
+        { "help",   no_argument,       NULL, 'h' },
+        { NULL,     0,                 NULL,  0  }
+    };
+
+    numRooms = DEFAULT_ROOMS;
+    params.generator = CONNECTED_GENERATOR;
+    params.numShards = 0;
+    params.minDegree = MIN_ADJ;
+    params.maxDegree = MAX_ADJ;
+
+    // Use one thread per processor unless told otherwise.
+    //
+    numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(numThreads < 1) {
+        numThreads = 1;
+    } else if(numThreads > MAX_THREADS) {
+        numThreads = MAX_THREADS;
+    }
+
+    while((opt = getopt_long(argc, argv, "r:f:l:e:t:d:Ls:g:m:M:b:u:P:C:k:K:j:x:a:w:BR:D:JS:F:h", longOpts, NULL)) != -1) {
+        switch(opt) {
+            case 'r':
+                numRooms = strtol(optarg, NULL, 10);
+                if(numRooms < MIN_ROOMS || numRooms > 100000000) {
+                    fprintf(stderr, "Invalid room count: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'f':
+                if(strcmp(optarg, "text") == 0) {
+                    format = TEXT_FORMAT;
+                } else if(strcmp(optarg, "binary") == 0) {
+                    format = BINARY_FORMAT;
+                } else {
+                    fprintf(stderr, "Invalid format: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'l':
+                loadName = optarg;
+                break;
+            case 'e':
+                exportName = optarg;
+                break;
+            case 'b':
+                batchName = optarg;
+                break;
+            case 'u':
+                serveName = optarg;
+                break;
+            case 'P':
+                if(strcmp(optarg, "text") == 0) {
+                    protocol = TEXT_PROTOCOL;
+                } else if(strcmp(optarg, "json") == 0) {
+                    protocol = JSON_PROTOCOL;
+                } else {
+                    fprintf(stderr, "Invalid protocol: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'C':
+                cacheName = optarg;
+                break;
+            case 'k':
+                saveName = optarg;
+                break;
+            case 'K':
+                resumeName = optarg;
+                break;
+            case 'j':
+                journalName = optarg;
+                break;
+            case 'x':
+                journalRead = optarg;
+                break;
+            case 'a':
+                analyzePlayers = strtoll(optarg, NULL, 10);
+                if(analyzePlayers < 1) {
+                    fprintf(stderr, "Invalid game count: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'w':
+                numWorlds = strtol(optarg, NULL, 10);
+                if(numWorlds < 1 || numWorlds > 1000000) {
+                    fprintf(stderr, "Invalid world count: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'B':
+                bench = 1;
+                break;
+            case 'R':
+                benchRooms = optarg;
+                break;
+            case 'D':
+                benchDegrees = optarg;
+                break;
+            case 'J':
+                benchJson = 1;
+                break;
+            case 'S':
+                if(strcmp(optarg, "json") == 0) {
+                    stats.format = STATS_JSON;
+                } else if(strcmp(optarg, "prom") == 0) {
+                    stats.format = STATS_PROM;
+                } else {
+                    fprintf(stderr, "Invalid stats format: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'F':
+                stats.outName = optarg;
+                break;
+            case 't':
+                numThreads = strtol(optarg, NULL, 10);
+                if(numThreads < 1 || numThreads > MAX_THREADS) {
+                    fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'L':
+                lazy = 1;
+                break;
+            case 'd':
+                params.numShards = (int) strtol(optarg, NULL, 10);
+                if(params.numShards < 0 || params.numShards > MAX_SHARDS) {
+                    fprintf(stderr, "Invalid shard count: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 's':
+                errno = 0;
+                params.seed = strtoull(optarg, &endPtr, 0);
+                if(errno != 0 || endPtr == optarg || *endPtr != '\0') {
+                    fprintf(stderr, "Invalid seed: %s\n", optarg);
+                    exit(1);
+                }
+                seedSet = 1;
+                break;
+            case 'g':
+                if(strcmp(optarg, "classic") == 0) {
+                    params.generator = CLASSIC_GENERATOR;
+                } else if(strcmp(optarg, "connected") == 0) {
+                    params.generator = CONNECTED_GENERATOR;
+                } else {
+                    fprintf(stderr, "Invalid generator: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'm':
+                params.minDegree = (int) strtol(optarg, NULL, 10);
+                if(params.minDegree < 1 ||
+                   params.minDegree > MAX_DEGREE_LIMIT) {
+                    fprintf(stderr, "Invalid minimum degree: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'M':
+                params.maxDegree = (int) strtol(optarg, NULL, 10);
+                if(params.maxDegree < 2 ||
+                   params.maxDegree > MAX_DEGREE_LIMIT) {
+                    fprintf(stderr, "Invalid maximum degree: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'h':
+                printUsage(argv[0]);
+                return 0;
+            default:
+                printUsage(argv[0]);
+                exit(1);
+        }
+    }
+
+    params.numRooms = (int) numRooms;
+    params.numThreads = (int) numThreads;
+
+    if(params.minDegree > params.maxDegree) {
+        fprintf(stderr, "Minimum degree %d is above maximum degree %d\n",
+                params.minDegree, params.maxDegree);
+        exit(1);
+    }
+
+    if(seedSet == 0) {
+        params.seed = (bench ? BENCH_SEED : (uint64_t) time(NULL));
+    }
+
+    // A resumed game keeps saving to the checkpoint it came from.
+    //
+    if(saveName == NULL) {
+        saveName = resumeName;
+    }
+
+    // Dump the instrumentation however the program ends.
+    //
+    if(stats.format != STATS_OFF) {
+        atexit(dumpStats);
+    }
+
+    // Decoding a journal needs no World at all.
+    //
+    if(journalRead != NULL) {
+        return readJournal(journalRead);
+    }
+
+    // The benchmark builds its own Worlds and plays them itself.
+    //
+    if(bench) {
+        return runBenchmark(&params, roomNames, benchRooms, benchDegrees,
+                            benchJson);
+    }
+
+    // Analyzing new Worlds only needs them in memory.
+    //
+    if(analyzePlayers > 0 && loadName == NULL) {
+        return runAnalysis(&params, roomNames, NULL, analyzePlayers,
+                           (int) numWorlds);
+    }
+
+    if(loadName != NULL) {
+        // Play an existing World instead of making a new one. A directory
+        // holds text Room files, anything else is a binary world file.
+        //
+        STAT_ADD(statCalls, 1);
+        if(stat(loadName, &loadStat) != 0) {
+            printf("Error opening %s: errno = %d\n", loadName, errno);
+            exit(1);
+        }
+        format = (S_ISDIR(loadStat.st_mode) ? TEXT_FORMAT : BINARY_FORMAT);
+        snprintf(dirName, MAX_PATH_CHARS, "%s", loadName);
+    } else if(cacheName != NULL) {
+        // Map the World from the cache, which only builds it on a miss.
+        // Cached Worlds are always binary world files.
+        //
+        if(loadCachedWorld(&world, &params, cacheName, roomNames) != 0) {
+            exit(1);
+        }
+        format = BINARY_FORMAT;
+        cached = 1;
+    } else if(format == TEXT_FORMAT) {
+        // Name the output file directory. The name is hardcoded to
+        // include my ONID username (ratclier), then ".rooms.", then the
+        // PID of the running program. writeRooms() creates it, complete,
+        // in one rename. This directory is not removed at the end of the
+        // game, per assignment guidelines.
+        //
+        sprintf(dirName, "%s.%ld", "ratclier.rooms", (long) getpid());
+
+        // Set up the Room files.
+        //
+        if(setupRooms(&world, &params, dirName, roomNames, format) != 0) {
+            exit(1);
+        }
+    } else {
+        // A binary World is a single file, named like the directory.
+        //
+        sprintf(dirName, "%s.%ld", "ratclier.world", (long) getpid());
+        if(setupRooms(&world, &params, dirName, roomNames, format) != 0) {
+            exit(1);
+        }
+    }
+
+    // Read the Room data in from files (or only get ready to, with
+    // --lazy), or map the world file. An export needs every Room, and
+    // so does the id of a World that games are checkpointed on, so
+    // they always read them all. So does a served World: one slow Room
+    // file would stall every game in the event loop, and the games
+    // share it read-only. A World from the cache is mapped already.
+    //
+    if(cached == 0) {
+        phaseStart = statsStart();
+        if(format == TEXT_FORMAT && lazy && exportName == NULL &&
+           analyzePlayers == 0 && saveName == NULL && serveName == NULL) {
+            if(readRoomsLazy(&world, dirName) != 0) {
+                exit(1);
+            }
+        } else if(format == TEXT_FORMAT) {
+            if(readRooms(&world, dirName, params.numThreads) != 0) {
+                exit(1);
+            }
+        } else if(mapWorld(&world, dirName) != 0) {
+            exit(1);
+        }
+        statsStop(LOAD_PHASE, phaseStart);
+    }
+
+    // Export the World as text Room files if asked to, so tools that
+    // only understand the directory format can work with it.
+    //
+    if(exportName != NULL) {
+        phaseStart = statsStart();
+        if(writeRooms(&world, exportName, params.numThreads,
+                      params.numShards) != 0) {
+            exit(1);
+        }
+        statsStop(EXPORT_PHASE, phaseStart);
+    }
+
+    // Journal every game played from here on. Simulated players are not
+    // journaled.
+    //
+    if(journalName != NULL && analyzePlayers == 0) {
+        if(journalOpen(journalName, world.numRooms) != 0) {
+            exit(1);
+        }
+        atexit(journalClose);
+    }
+
+    // Play the game, replay the scripted sessions, serve games to
+    // whoever connects, or simulate players.
+    //
+    phaseStart = statsStart();
+    if(analyzePlayers > 0) {
+        if(runAnalysis(&params, roomNames, &world, analyzePlayers, 1) != 0) {
+            exit(1);
+        }
+    } else if(serveName != NULL) {
+        if(serveGames(&world, serveName, protocol) != 0) {
+            exit(1);
+        }
+    } else if(batchName != NULL) {
+        if(playBatch(&world, batchName) != 0) {
+            exit(1);
+        }
+    } else if(protocol == JSON_PROTOCOL) {
+        playProtocol(&world, saveName, resumeName);
+    } else {
+        playGame(&world, saveName, resumeName);
+    }
+    statsStop(PLAY_PHASE, phaseStart);
+
+    // Clean up the Rooms.
+    //
+    cleanRooms(&world);
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// hashName(const char *name, int len)
+//
+// Purpose: FNV-1a hash of a Room name, used to pick a nameIndex[] slot.
+//
+// *****************************************************************************
+//
+static uint32_t hashName(const char *name, int len) {
+
+    uint32_t hash = 2166136261u;    // FNV offset basis
+
+    while(len-- > 0) {
+        hash ^= (unsigned char) *name++;
+        hash *= 16777619u;          // FNV prime
+    }
+
+    return hash;
+
+}
+
+
+// Pieces of made up Room names (see makeName()). Every onset, vowel and
+// coda goes together into one syllable, and they are all plain lower
+// case letters, so the names are easy to read and to type.
+//
+static const char *nameOnsets[] = {
+    "b", "br", "c", "ch", "d", "dr", "f", "g", "gr", "h", "j", "k", "l",
+    "m", "n", "p", "pr", "r", "s", "sh", "st", "t", "tr", "v", "w", "z" };
+static const char *nameVowels[] = {
+    "a", "e", "i", "o", "u", "ai", "au", "ea", "ei", "ou" };
+static const char *nameCodas[] = {
+    "", "n", "r", "s", "l", "m", "nd", "st" };
+
+#define NAME_ONSETS ((int) (sizeof(nameOnsets) / sizeof(nameOnsets[0])))
+#define NAME_VOWELS ((int) (sizeof(nameVowels) / sizeof(nameVowels[0])))
+#define NAME_CODAS ((int) (sizeof(nameCodas) / sizeof(nameCodas[0])))
+
+
+// *****************************************************************************
+// 
+// nameSyllables(int numRooms)
+//
+// Purpose: Pick how many syllables the names of a World get: the fewest
+//          (but at least 2) that give NAME_SPARSENESS times more names
+//          than there are Rooms, so clashes stay rare.
+//
+// *****************************************************************************
+//
+static int nameSyllables(int numRooms) {
+
+    int syllables = 2;           // syllables per name
+    double names;                // different names with that many
+
+    names = (double) NAME_ONSETS * NAME_VOWELS * NAME_CODAS;
+    names *= names;
+    while(names < (double) numRooms * NAME_SPARSENESS) {
+        names *= (double) NAME_ONSETS * NAME_VOWELS * NAME_CODAS;
+        syllables++;
+    }
+
+    return syllables;
+
+}
+
+
+// *****************************************************************************
+// 
+// makeName(char *name, struct Rng *rng, int syllables)
+//
+// Purpose: Make up a Room name of random syllables, with a capital first
+//          letter (Brailon, Mousteitr, ...). The name never takes more
+//          than MAX_ROOM_CHARS bytes with its NUL. Returns its length.
+//
+// *****************************************************************************
+//
+static int makeName(char *name, struct Rng *rng, int syllables) {
+
+    int x;                       // loop iterator
+    int len = 0;                 // length of the name so far
+
+    const char *piece;           // onset, vowel or coda being added
+
+    for(x = 0; x < syllables; x++) {
+        piece = nameOnsets[rngBounded(rng, NAME_ONSETS)];
+        while(*piece != '\0') {
+            name[len++] = *piece++;
+        }
+        piece = nameVowels[rngBounded(rng, NAME_VOWELS)];
+        while(*piece != '\0') {
+            name[len++] = *piece++;
+        }
+        piece = nameCodas[rngBounded(rng, NAME_CODAS)];
+        while(*piece != '\0') {
+            name[len++] = *piece++;
+        }
+    }
+    name[0] -= 'a' - 'A';
+    name[len] = '\0';
+
+    return len;
+
+}
+
+
+// struct SetupTask: One worker thread's share of setupRooms(). Each
+// worker owns the Rooms first through last-1.
+//
+// phase      -> Which part of the setup to run (see setupWorker()).
+//
+// nameSlots  -> Scratch space holding MAX_ROOM_CHARS bytes per Room, where
+//               names are formatted before being packed into the
+//               string table.
+//
+// namesBytes -> Bytes of string table the worker's names take up.
+//
+// namesPos   -> Where in the string table the worker's names start.
+//
+// edgeFrom[], edgeTo[]
+//            -> Connection arrays shared by all workers. Room i's picks go
+//               in slots i*MIN_ADJ through i*MIN_ADJ+MIN_ADJ-1, so no two
+//               workers touch the same slot.
+//
+struct SetupTask {
+    int phase;
+    struct World *world;
+    struct GenParams *params;
+    int first;
+    int last;
+    char *nameSlots;
+    int namesBytes;
+    int namesPos;
+    int *edgeFrom;
+    int *edgeTo;
+};
+
+enum setupPhase { NAME_PHASE, PACK_PHASE, EDGE_PHASE };
+
+
+// *****************************************************************************
+// 
+// setupWorker(void *arg)
+//
+// Purpose: Run one phase of setupRooms() on one worker's Rooms.
+//
+// *****************************************************************************
+//
+static void *setupWorker(void *arg) {
+
+    struct SetupTask *task = (struct SetupTask *) arg;
+    struct World *world = task->world;
+
+    int i, x;                    // loop iterators
+    int num;                     // holds number generated by rngBounded()
+    int nameLen;                 // length of a Room name, without the NUL
+    int numRooms;                // number of Rooms in the World
+    int syllables;               // syllables in each Room name
+
+    struct Rng rng;              // the Room's random number stream
+
+    char *slot;                  // the Room's slot in nameSlots[]
+
+    numRooms = world->numRooms;
+
+    switch(task->phase) {
+
+        case NAME_PHASE:
+            // There are not enough composer names to go around, so make
+            // names up. Each Room draws its name from its own stream, so
+            // the name depends only on the seed and the Room. Names can
+            // clash; generateRooms() sorts that out afterwards.
+            //
+            // Names are different lengths, so they can't go straight
+            // into the string table until every worker knows how much
+            // space its names need. Park each one in its own slot and
+            // borrow nameOff to hold its length until PACK_PHASE.
+            //
+            syllables = nameSyllables(numRooms);
+            task->namesBytes = 0;
+            for(i = task->first; i < task->last; i++) {
+                slot = task->nameSlots + (size_t) i * MAX_ROOM_CHARS;
+                rngSeed(&rng, task->params->seed, NAME_STREAM + i);
+                nameLen = makeName(slot, &rng, syllables);
+                world->rooms[i].nameOff = nameLen;
+                task->namesBytes += nameLen + 1;
+            }
+            break;
+
+        case PACK_PHASE:
+            // Copy the names into the worker's stretch of the string
+            // table, which starts at namesPos.
+            //
+            for(i = task->first; i < task->last; i++) {
+                slot = task->nameSlots + (size_t) i * MAX_ROOM_CHARS;
+                nameLen = world->rooms[i].nameOff;
+                memcpy(world->names + task->namesPos, slot, nameLen + 1);
+                world->rooms[i].nameOff = task->namesPos;
+                task->namesPos += nameLen + 1;
+            }
+            break;
+
+        case EDGE_PHASE:
+            // Assign a minimum of 3 adjacent Rooms for each Room. Since
+            // each connection is two-way, it's possible that a maximum of
+            // numRooms-1 Rooms can be adjacent.
+            //
+            // Each Room uses its own stream, so its picks depend only on
+            // the seed and the Room, never on which thread makes them.
+            //
+            for(i = task->first; i < task->last; i++) {
+                rngSeed(&rng, task->params->seed, (uint64_t) i + 1);
+                for(x = 0; x < MIN_ADJ; x++) {
+                    // Be sure to not assign a Room as being adjacent to
+                    // itself! Pick from the other numRooms-1 Rooms by
+                    // skipping over the current one, so there is never a
+                    // need to pick again.
+                    //
+                    num = rngBounded(&rng, numRooms - 1);
+                    if(num >= i) {
+                        num++;
+                    }
+
+                    task->edgeFrom[i * MIN_ADJ + x] = i;
+                    task->edgeTo[i * MIN_ADJ + x] = num;
+                }
+            }
+            break;
+    }
+
+    return NULL;
+
+}
+
+
+// *****************************************************************************
+// 
+// setupRooms(struct World *world, struct GenParams *params,
+//            char outName[], char *roomNames[], enum worldFormat format)
+//
+// Purpose: Create Rooms and output the data to files.
+//
+// *****************************************************************************
+//
+int setupRooms(struct World *world, struct GenParams *params,
+               char outName[], char *roomNames[], enum worldFormat format) {
+
+    int result;                  // what writing the files returned
+
+    double phaseStart;           // when the phase being timed began
+
+    // Create the Rooms.
+    //
+    phaseStart = statsStart();
+    generateRooms(world, params, roomNames);
+    statsStop(GENERATE_PHASE, phaseStart);
+
+    // Write the Rooms out in the requested format.
+    //
+    phaseStart = statsStart();
+    if(format == TEXT_FORMAT) {
+        result = writeRooms(world, outName, params->numThreads,
+                            params->numShards);
+    } else {
+        result = writeWorld(world, outName, worldKey(params));
+    }
+    statsStop(WRITE_PHASE, phaseStart);
+
+    // Delete all Rooms from the World.
+    //
+    cleanRooms(world);
+
+    return result;
+
+}
+
+
+// *****************************************************************************
+// 
+// generateRooms(struct World *world, struct GenParams *params,
+//               char *roomNames[])
+//
+// Purpose: Create Rooms in memory.
+//
+// *****************************************************************************
+//
+int generateRooms(struct World *world, struct GenParams *params,
+                  char *roomNames[]) {
+
+    int i, t, x;                 // loop iterators
+    int num;                     // holds number generated by rngBounded()
+    int numRooms;                // number of Rooms to create
+    int numTasks;                // number of worker threads
+    int nameLen;                 // length of a Room name, without the NUL
+    int *edgeFrom = NULL;        // one end of each connection
+    int *edgeTo = NULL;          // other end of each connection
+
+    char *namePool[10];          // composer names, shuffled as they are used
+    char *swapName;              // holds a name while swapping two
+    char *slot;                  // a Room's slot in nameSlots[]
+
+    int tries;                   // names a Room has drawn so far
+    int syllables;               // syllables in each made up name
+    uint32_t hash;               // hashName() of a Room's name
+    size_t tableSize;            // slots in seen[], a power of two
+    size_t pos;                  // slot of seen[] being probed
+
+    struct NameSlot *seen;       // names taken so far, by hash
+    struct Rng nameRng;          // stream of a Room whose name is taken
+
+    struct Rng rng;              // random number stream for the whole World
+
+    struct SetupTask tasks[MAX_THREADS]; // one per worker thread
+
+    numRooms = params->numRooms;
+    world->numRooms = numRooms;
+
+    // Seed the random number generator. Each Room also gets a stream of
+    // its own (see setupWorker()); this one is for choices about the
+    // World as a whole.
+    //
+    rngSeed(&rng, params->seed, 0);
+
+    // Don't start more workers than there are Rooms.
+    //
+    numTasks = (params->numThreads < numRooms ? params->numThreads : numRooms);
+
+    //
+    // *******************************************************************
+    // Set up the array of Room structs. Initially, all rooms have no
+    // adjacent rooms and all room types are set to MID_ROOM for
+    // simplicity.
+    // *******************************************************************
+    //
+
+    world->rooms = (struct Room *) calloc(numRooms, sizeof(struct Room));
+
+    // Names are packed into the string table one after another. None of
+    // them can be longer than MAX_ROOM_CHARS, so that is enough room.
+    //
+    world->names = (char *) malloc((size_t) numRooms * MAX_ROOM_CHARS);
+    world->namesSize = 0;
+
+    if(world->rooms == NULL || world->names == NULL) {
+        printf("Error allocating %d Rooms\n", numRooms);
+        exit(1);
+    }
+
+    // Split the Rooms evenly between the workers.
+    //
+    for(t = 0; t < numTasks; t++) {
+        tasks[t].world = world;
+        tasks[t].params = params;
+        tasks[t].first = (int) ((long long) numRooms * t / numTasks);
+        tasks[t].last = (int) ((long long) numRooms * (t + 1) / numTasks);
+    }
+
+    // All rooms start off with type MID_ROOM and no adjacent rooms (see
+    // buildAdjacency()), which calloc() already took care of.
+    //
+    for(i = 0; i < numRooms; i++) {
+        world->rooms[i].type = MID_ROOM;
+    }
+
+    if(numRooms <= 10) {
+        // With only a handful of Rooms, hand out the composer names at
+        // random. This is a partial Fisher-Yates shuffle: Room i swaps a
+        // random name from the not-yet-used part of the pool (i through
+        // 9) into position i and takes it, so a name can never be picked
+        // twice and no pick ever has to be retried.
+        //
+        memcpy(namePool, roomNames, sizeof(namePool));
+        for(i = 0; i < numRooms; i++) {
+            num = i + rngBounded(&rng, 10 - i);
+            swapName = namePool[i];
+            namePool[i] = namePool[num];
+            namePool[num] = swapName;
+
+            // Copy Room name to the string table
+            //
+            nameLen = snprintf(world->names + world->namesSize,
+                               MAX_ROOM_CHARS, "%s", namePool[i]);
+            world->rooms[i].nameOff = world->namesSize;
+            world->namesSize += nameLen + 1;
+        }
+    } else {
+        // Otherwise the workers make up names for their own Rooms, then
+        // pack the names into the string table one after another.
+        //
+        char *nameSlots = (char *) malloc((size_t) numRooms * MAX_ROOM_CHARS);
+        for(tableSize = 16; tableSize < (size_t) numRooms * 2; tableSize *= 2) {
+        }
+        seen = (struct NameSlot *) malloc(sizeof(struct NameSlot) *
+                                          tableSize);
+        if(nameSlots == NULL || seen == NULL) {
+            printf("Error allocating %d Room names\n", numRooms);
+            exit(1);
+        }
+
+        for(t = 0; t < numTasks; t++) {
+            tasks[t].phase = NAME_PHASE;
+            tasks[t].nameSlots = nameSlots;
+        }
+        runWorkers(setupWorker, tasks, sizeof(struct SetupTask), numTasks);
+
+        // Make the names unique. Going through the Rooms in order, each
+        // name is looked up in a hash table of the names before it, which
+        // takes one probe or so. A Room whose name is taken draws the
+        // next name from its stream, until it finds a free one. The order
+        // never changes, so neither do the names, whatever the number of
+        // threads.
+        //
+        syllables = nameSyllables(numRooms);
+        memset(seen, 0xff, sizeof(struct NameSlot) * tableSize);
+        t = 0;
+        for(i = 0; i < numRooms; i++) {
+            slot = nameSlots + (size_t) i * MAX_ROOM_CHARS;
+            while(i >= tasks[t].last) {
+                t++;
+            }
+            for(tries = 1; ; tries++) {
+                hash = hashName(slot, world->rooms[i].nameOff);
+                pos = hash & (tableSize - 1);
+                while(seen[pos].room >= 0 &&
+                      (seen[pos].hash != hash ||
+                       strcmp(nameSlots + (size_t) seen[pos].room *
+                              MAX_ROOM_CHARS, slot) != 0)) {
+                    pos = (pos + 1) & (tableSize - 1);
+                }
+                if(seen[pos].room < 0) {
+                    seen[pos].room = i;
+                    seen[pos].hash = hash;
+                    break;
+                }
+
+                rngSeed(&nameRng, params->seed, NAME_STREAM + i);
+                for(x = 0; x <= tries; x++) {
+                    nameLen = makeName(slot, &nameRng, syllables);
+                }
+                tasks[t].namesBytes += nameLen - world->rooms[i].nameOff;
+                world->rooms[i].nameOff = nameLen;
+            }
+        }
+        free(seen);
+
+        for(t = 0; t < numTasks; t++) {
+            tasks[t].phase = PACK_PHASE;
+            tasks[t].namesPos = world->namesSize;
+            world->namesSize += tasks[t].namesBytes;
+        }
+        runWorkers(setupWorker, tasks, sizeof(struct SetupTask), numTasks);
+
+        free(nameSlots);
+    }
+
+    // Determine START and END rooms. All Rooms are currently set to
+    // MID_ROOM so just pick one random Room each for the START and END,
+    // picking the END from the Rooms other than the START.
+    //
+    i = rngBounded(&rng, numRooms);
+    world->rooms[i].type = START_ROOM;
+    num = rngBounded(&rng, numRooms - 1);
+    if(num >= i) {
+        num++;
+    }
+    world->rooms[num].type = END_ROOM;
+ 
+
+    if(params->generator == CONNECTED_GENERATOR) {
+        // Build a connected World with bounded connections per Room.
+        // This has to be done in one go, so it runs on this thread.
+        //
+        if(connectRooms(world, params, &rng) != 0) {
+            exit(1);
+        }
+    } else {
+        // Pick adjacent Rooms. Each pick is a two-way connection recorded
+        // in edgeFrom[] and edgeTo[]. buildAdjacency() then packs the
+        // connections into one list per Room.
+        //
+        edgeFrom = (int *) malloc(sizeof(int) * numRooms * MIN_ADJ);
+        edgeTo = (int *) malloc(sizeof(int) * numRooms * MIN_ADJ);
+        if(edgeFrom == NULL || edgeTo == NULL) {
+            printf("Error allocating %d connections\n", numRooms * MIN_ADJ);
+            exit(1);
+        }
+
+        for(t = 0; t < numTasks; t++) {
+            tasks[t].phase = EDGE_PHASE;
+            tasks[t].edgeFrom = edgeFrom;
+            tasks[t].edgeTo = edgeTo;
+        }
+        runWorkers(setupWorker, tasks, sizeof(struct SetupTask), numTasks);
+
+        if(buildAdjacency(world, edgeFrom, edgeTo, numRooms * MIN_ADJ) != 0) {
+            printf("Error allocating %d connections\n",
+                   numRooms * MIN_ADJ * 2);
+            exit(1);
+        }
+
+        free(edgeFrom);
+        free(edgeTo);
+    }
+
+    // Work out how far every Room is from the END ROOM, so the distances
+    // can be stored along with the Rooms.
+    //
+    if(computeDistances(world) != 0) {
+        printf("Error allocating %d Rooms\n", numRooms);
+        exit(1);
+    }
+
+    // Gather the finished World into one block of memory.
+    //
+    if(packWorld(world) != 0) {
+        printf("Error allocating %d Rooms\n", numRooms);
+        exit(1);
+    }
+
+    return 0;
+
+}
+
+
+// struct RoomDir: An open text Room file directory. Room files are
+// opened relative to dirFd, the directory itself, or to
+// shardFds[shardOf(name)] when they are spread over numShards
+// subdirectories (see roomDirFd()).
+//
+struct RoomDir {
+    char *dirName;
+    int dirFd;
+    int *shardFds;
+    int numShards;
+};
+
+
+// *****************************************************************************
+// 
+// openRoomDir(struct RoomDir *dir, char dirName[], int dirFd,
+//             int numShards, int create)
+//
+// Purpose: Open the subdirectories of an already open Room file
+//          directory, making them first if create is 1.
+//
+// *****************************************************************************
+//
+static void openRoomDir(struct RoomDir *dir, char dirName[], int dirFd,
+                        int numShards, int create) {
+
+    int i;                       // loop iterator
+
+    char shardName[16];          // name of one subdirectory
+
+    dir->dirName = dirName;
+    dir->dirFd = dirFd;
+    dir->shardFds = NULL;
+    dir->numShards = numShards;
+    if(numShards == 0) {
+        return;
+    }
+
+    dir->shardFds = (int *) malloc(sizeof(int) * numShards);
+    if(dir->shardFds == NULL) {
+        printf("Error allocating %d shards\n", numShards);
+        exit(1);
+    }
+    for(i = 0; i < numShards; i++) {
+        snprintf(shardName, sizeof(shardName), "%03x", i);
+        if(create) {
+            mkdirat(dirFd, shardName, 0755);
+            STAT_ADD(dirsCreated, 1);
+        }
+        dir->shardFds[i] = openat(dirFd, shardName, O_RDONLY | O_DIRECTORY);
+        if(dir->shardFds[i] < 0) {
+            printf("Error opening %s/%s: errno = %d\n", dirName, shardName,
+                   errno);
+            exit(1);
+        }
+    }
+
+}
+
+
+// *****************************************************************************
+// 
+// closeRoomDir(struct RoomDir *dir)
+//
+// Purpose: Close the subdirectories opened by openRoomDir(). The
+//          directory itself belongs to the caller.
+//
+// *****************************************************************************
+//
+static void closeRoomDir(struct RoomDir *dir) {
+
+    int i;                       // loop iterator
+
+    for(i = 0; i < dir->numShards; i++) {
+        close(dir->shardFds[i]);
+    }
+    free(dir->shardFds);
+    dir->shardFds = NULL;
+    dir->numShards = 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// roomDirFd(struct RoomDir *dir, const char *name)
+//
+// Purpose: Pick the directory a Room's file is opened relative to.
+//
+// *****************************************************************************
+//
+static int roomDirFd(struct RoomDir *dir, const char *name) {
+
+    return (dir->numShards > 0 ? dir->shardFds[shardOf(name, dir->numShards)]
+                               : dir->dirFd);
+
+}
+
+
+// *****************************************************************************
+//
+// bufReserve(char **buf, size_t *len, size_t *size, size_t more)
+//
+// Purpose: Grow a text buffer, if need be, so it holds more more bytes
+//          after the len it already has.
+//
+// *****************************************************************************
+//
+static void bufReserve(char **buf, size_t *len, size_t *size, size_t more) {
+
+    char *grown;         // buf after growing it
+
+    if(*len + more <= *size) {
+        return;
+    }
+    while(*len + more > *size) {
+        *size = (*size == 0 ? 1024 : *size * 2);
+    }
+    grown = (char *) realloc(*buf, *size);
+    if(grown == NULL) {
+        printf("Error allocating %d bytes of output\n", (int) *size);
+        exit(1);
+    }
+    *buf = grown;
+
+}
+
+
+// *****************************************************************************
+//
+// bufPrintf(char **buf, size_t *len, size_t *size, const char *format,
+//           ...)
+//
+// Purpose: Append formatted text to a growable buffer, like printf().
+//          The text is formatted straight into the free space, and only
+//          formatted again if it did not fit.
+//
+// *****************************************************************************
+//
+static void bufPrintf(char **buf, size_t *len, size_t *size,
+                      const char *format, ...) {
+
+    va_list args;        // the values to print
+    int n;               // length of the formatted text
+
+    va_start(args, format);
+    n = vsnprintf(*buf + *len, *size - *len, format, args);
+    va_end(args);
+
+    if(*len + n + 1 > *size) {
+        bufReserve(buf, len, size, n + 1);
+        va_start(args, format);
+        vsnprintf(*buf + *len, n + 1, format, args);
+        va_end(args);
+    }
+    *len += n;
+
+}
+
+
+// *****************************************************************************
+// 
+// writeWhole(int fd, const char *buf, size_t len)
+//
+// Purpose: Write all of buf[] to a file, going round again if write()
+//          comes up short. Returns 0, or -1 for error.
+//
+// *****************************************************************************
+//
+static int writeWhole(int fd, const char *buf, size_t len) {
+
+    size_t done = 0;     // bytes written so far
+    ssize_t sent;        // bytes taken by the last write()
+
+    while(done < len) {
+        sent = write(fd, buf + done, len - done);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += sent;
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// syncParent(const char *path)
+//
+// Purpose: Flush the directory holding path, so that a file or
+//          directory just renamed into it stays there after a crash.
+//          Returns 0, or -1 for error.
+//
+// *****************************************************************************
+//
+static int syncParent(const char *path) {
+
+    int fd;                      // the parent directory
+    int result;                  // what fsync() returned
+
+    const char *slash;           // last '/' in path
+
+    char parent[MAX_PATH_CHARS]; // name of the parent directory
+
+    slash = strrchr(path, '/');
+    if(slash == NULL) {
+        snprintf(parent, sizeof(parent), ".");
+    } else if(slash == path) {
+        snprintf(parent, sizeof(parent), "/");
+    } else {
+        snprintf(parent, sizeof(parent), "%.*s", (int) (slash - path), path);
+    }
+
+    fd = open(parent, O_RDONLY | O_DIRECTORY);
+    if(fd < 0) {
+        return -1;
+    }
+    result = fsync(fd);
+    close(fd);
+
+    return result;
+
+}
+
+
+// *****************************************************************************
+//
+// isRoomDir(int dirFd, int depth)
+//
+// Purpose: Decide whether an open directory is one writeRooms() made,
+//          so it may be replaced: it has a manifest, or it holds
+//          nothing but Room files and (at depth 0) shard
+//          subdirectories of Room files. Takes over dirFd and closes
+//          it. Returns 1 if so, 0 if not.
+//
+// *****************************************************************************
+//
+static int isRoomDir(int dirFd, int depth) {
+
+    int fd;                      // an entry, opened to be looked at
+    int isRoom = 1;              // 0 once an entry is not ours
+    ssize_t got;                 // bytes read from a file
+
+    char head[16];               // start of a file
+
+    DIR *dp;                     // the directory, opened for reading
+    struct dirent *dirFiles;     // struct that holds directory data
+    struct stat filestat;        // what kind of entry it is
+
+    dp = fdopendir(dirFd);
+    if(dp == NULL) {
+        close(dirFd);
+        return 0;
+    }
+
+    while(isRoom && (dirFiles = readdir(dp)) != NULL) {
+        if(strcmp(dirFiles->d_name, ".") == 0 ||
+           strcmp(dirFiles->d_name, "..") == 0) {
+            continue;
+        }
+        if(depth == 0 && strcmp(dirFiles->d_name, MANIFEST_NAME) == 0) {
+            break;
+        }
+        if(fstatat(dirfd(dp), dirFiles->d_name, &filestat,
+                   AT_SYMLINK_NOFOLLOW) != 0) {
+            isRoom = 0;
+        } else if(S_ISREG(filestat.st_mode)) {
+
+            // A Room file starts with its name line (see writeWorker()).
+            //
+            fd = openat(dirfd(dp), dirFiles->d_name, O_RDONLY);
+            got = (fd >= 0 ? read(fd, head, 11) : -1);
+            isRoom = (got == 11 && memcmp(head, "ROOM NAME: ", 11) == 0);
+            if(fd >= 0) {
+                close(fd);
+            }
+        } else if(S_ISDIR(filestat.st_mode) && depth == 0 &&
+                  strlen(dirFiles->d_name) == 3 &&
+                  strspn(dirFiles->d_name, "0123456789abcdef") == 3) {
+            fd = openat(dirfd(dp), dirFiles->d_name, O_RDONLY | O_DIRECTORY);
+            isRoom = (fd >= 0 && isRoomDir(fd, 1));
+        } else {
+            isRoom = 0;
+        }
+    }
+    closedir(dp);
+
+    return isRoom;
+
+}
+
+
+// struct WriteTask: One worker thread's share of writeRooms(). Each
+// worker writes the files for Rooms first through last-1 into dir.
+//
+struct WriteTask {
+    struct World *world;
+    struct RoomDir *dir;
+    int first;
+    int last;
+};
+
+
+// *****************************************************************************
+// 
+// writeWorker(void *arg)
+//
+// Purpose: Output the Room files for one worker's Rooms.
+//
+// *****************************************************************************
+//
+static void *writeWorker(void *arg) {
+
+    struct WriteTask *task = (struct WriteTask *) arg;
+    struct World *world = task->world;
+
+    int i, x;                    // loop iterators
+
+    long long written = 0;       // bytes written to all the worker's files
+
+    int fd;                      // output file descriptor
+
+    char *out = NULL;            // text of the Room file being written
+    size_t outLen;               // bytes used in out[]
+    size_t outSize = 0;          // bytes allocated for out[]
+
+    struct Room *room;           // Room being written out
+
+    static const char *typeNames[] = { "START_ROOM", "END_ROOM", "MID_ROOM" };
+
+    // For each Room, write one Room file to the output directory.
+    //
+    for(i = task->first; i < task->last; i++) {
+
+        room = &world->rooms[i];
+
+        // Build the whole file in memory first, so it goes out in one
+        // write(). The buffer is reused from Room to Room.
+        //
+        // Write the Room name, then the adjacent Rooms ("CONNECTIONS").
+        // Be sure to add a count to each of the lines:
+        //
+        //    CONNECTION 1: Roomname
+        //    CONNECTION 2: Roomname
+        //    ...
+        //
+        outLen = 0;
+        bufPrintf(&out, &outLen, &outSize, "ROOM NAME: %s\n",
+                  roomName(world, i));
+        for(x = 0; x < room->adjCount; x++) {
+            bufPrintf(&out, &outLen, &outSize, "CONNECTION %d: %s\n", x + 1,
+                      roomName(world, world->adjList[room->adjStart + x]));
+        }
+
+        // Write the Room's distance from the END ROOM, so hints work even
+        // when the Rooms are loaded one at a time, then the Room type.
+        // To make things pretty when typing to the screen, the file ends
+        // with a newline.
+        //
+        bufPrintf(&out, &outLen, &outSize, "END DISTANCE: %d\n",
+                  room->endDist);
+        bufPrintf(&out, &outLen, &outSize, "ROOM TYPE: %s\n",
+                  typeNames[room->type]);
+
+        // Open the file relative to the output directory, which saves
+        // looking the directory up again for every file, and write it.
+        // Nothing is synced here; writeRooms() syncs the whole directory
+        // once at the end.
+        //
+        fd = openat(roomDirFd(task->dir, roomName(world, i)),
+                    roomName(world, i), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        // If there was a problem, exit with an error.
+        //
+        if(fd < 0) {
+            printf("Error opening %s/%s: errno = %d\n", task->dir->dirName,
+                   roomName(world, i), errno);
+            exit(1);
+        }
+
+        STAT_ADD(filesOpened, 1);
+
+        if(writeWhole(fd, out, outLen) != 0) {
+            printf("Error writing %s/%s: errno = %d\n", task->dir->dirName,
+                   roomName(world, i), errno);
+            exit(1);
+        }
+        close(fd);
+        written += outLen;
+    }
+
+    free(out);
+    STAT_ADD(bytesWritten, written);
+
+    return NULL;
+
+}
+
+
+// *****************************************************************************
+// 
+// writeRooms(struct World *world, char dirName[], int numThreads,
+//            int numShards)
+//
+// Purpose: Output one text file per Room.
+//
+// *****************************************************************************
+//
+int writeRooms(struct World *world, char dirName[], int numThreads,
+               int numShards) {
+
+    int i, t;                    // loop iterators
+    int numTasks;                // number of worker threads
+    int dirFd;                   // the open staging directory
+    int fd;                      // manifest file descriptor
+
+    char *out = NULL;            // text of the manifest
+    size_t outLen = 0;           // bytes used in out[]
+    size_t outSize = 0;          // bytes allocated for out[]
+
+    char stageName[MAX_PATH_CHARS]; // where the files are written first
+
+    double phaseStart;           // when making stageName began
+
+    struct RoomDir dir;          // where the Room files go
+
+    struct WriteTask tasks[MAX_THREADS]; // one per worker thread
+
+    // Everything is written into a staging directory next to dirName
+    // and only renamed to dirName once it is complete and on disk, so a
+    // crash never leaves a half written World under dirName. Left over
+    // staging directories from a crash are never loaded by name.
+    //
+    snprintf(stageName, MAX_PATH_CHARS, "%s.tmp.%ld", dirName,
+             (long) getpid());
+    phaseStart = statsStart();
+    if(mkdir(stageName, 0755) != 0) { // File permissions: u = rwx,
+                                      //   g = r-x, o = r-x
+        printf("Error creating %s: errno = %d\n", stageName, errno);
+        return 1;
+    }
+    STAT_ADD(dirsCreated, 1);
+    statsStop(MKDIR_PHASE, phaseStart);
+
+    // Open the staging directory once. Every Room file is created
+    // relative to it, or to one of its subdirectories, which are made
+    // and opened up front so the workers only ever create files.
+    //
+    dirFd = open(stageName, O_RDONLY | O_DIRECTORY);
+    if(dirFd < 0) {
+        printf("Error opening %s: errno = %d\n", stageName, errno);
+        exit(1);
+    }
+    openRoomDir(&dir, stageName, dirFd, numShards, 1);
+
+    // Each worker writes the files for an even share of the Rooms. Every
+    // Room has its own file, so the workers never get in each other's
+    // way, and the shards fill up side by side.
+    //
+    numTasks = (numThreads < world->numRooms ? numThreads : world->numRooms);
+    for(t = 0; t < numTasks; t++) {
+        tasks[t].world = world;
+        tasks[t].dir = &dir;
+        tasks[t].first = (int) ((long long) world->numRooms * t / numTasks);
+        tasks[t].last = (int) ((long long) world->numRooms * (t + 1) / numTasks);
+    }
+    runWorkers(writeWorker, tasks, sizeof(struct WriteTask), numTasks);
+
+    // List the Rooms in the manifest, in index order, after the START
+    // ROOM so a lazy load (see readRoomsLazy()) can begin there.
+    //
+    if(numShards > 0) {
+        bufPrintf(&out, &outLen, &outSize, "SHARDS: %d\n", numShards);
+        i = findStartRoom(world);
+        if(i >= 0) {
+            bufPrintf(&out, &outLen, &outSize, "START ROOM: %s\n",
+                      roomName(world, i));
+        }
+        for(i = 0; i < world->numRooms; i++) {
+            bufPrintf(&out, &outLen, &outSize, "ROOM NAME: %s\n",
+                      roomName(world, i));
+        }
+
+        fd = openat(dirFd, MANIFEST_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0 || writeWhole(fd, out, outLen) != 0) {
+            printf("Error writing %s/%s: errno = %d\n", stageName,
+                   MANIFEST_NAME, errno);
+            exit(1);
+        }
+        STAT_ADD(filesOpened, 1);
+        STAT_ADD(bytesWritten, outLen);
+        close(fd);
+        free(out);
+    }
+
+    // Flush every file and directory written above in one go. syncfs()
+    // covers the whole file system, which is far cheaper than an fsync()
+    // per Room file; elsewhere sync() has to do.
+    //
+#ifdef __linux__
+    if(syncfs(dirFd) != 0) {
+        printf("Error syncing %s: errno = %d\n", stageName, errno);
+        exit(1);
+    }
+#else
+    sync();
+#endif
+
+    closeRoomDir(&dir);
+    close(dirFd);
+
+    // Publish the World. rename() replaces dirName if it is missing or
+    // empty. A directory that already holds an earlier export is
+    // swapped with the staging directory in one step where the system
+    // can, and the old files are then deleted. Anything else in the way
+    // is not ours to delete, so it is left alone.
+    //
+    if(rename(stageName, dirName) != 0) {
+        if(errno == ENOTEMPTY || errno == EEXIST) {
+            fd = open(dirName, O_RDONLY | O_DIRECTORY);
+            if(fd < 0 || !isRoomDir(fd, 0)) {
+                printf("Error: %s holds files that are not Rooms, "
+                       "not replacing it\n", dirName);
+                removeWorld(stageName);
+                return 1;
+            }
+            errno = ENOTEMPTY;
+        }
+#ifdef RENAME_EXCHANGE
+        if(errno == ENOTEMPTY &&
+           renameat2(AT_FDCWD, stageName, AT_FDCWD, dirName,
+                     RENAME_EXCHANGE) == 0) {
+            removeWorld(stageName);
+        } else
+#endif
+        {
+            printf("Error renaming %s to %s: errno = %d\n", stageName,
+                   dirName, errno);
+            removeWorld(stageName);
+            return 1;
+        }
+    }
+    if(syncParent(dirName) != 0) {
+        printf("Error syncing the directory of %s: errno = %d\n", dirName,
+               errno);
+        return 1;
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// alignOffset(uint64_t offset)
+//
+// Purpose: Round a world file offset up to the next 8 byte boundary.
+//
+// *****************************************************************************
+//
+static uint64_t alignOffset(uint64_t offset) {
+
+    return (offset + 7) & ~((uint64_t) 7);
+
+}
+
+
+// *****************************************************************************
+// 
+// hashBytes(const void *data, size_t len, uint64_t hash)
+//
+// Purpose: Fold len bytes into a running 64-bit hash, 8 bytes at a time
+//          so a big world file is checked at memory speed. Not meant to
+//          stop anyone on purpose, only to catch damaged files.
+//
+// *****************************************************************************
+//
+static uint64_t hashBytes(const void *data, size_t len, uint64_t hash) {
+
+    const unsigned char *p = (const unsigned char *) data; // next bytes
+    uint64_t word;       // 8 bytes of data
+
+    while(len > 0) {
+        word = 0;
+        memcpy(&word, p, (len < 8 ? len : 8));
+        hash ^= word * 0x9e3779b97f4a7c15ULL;
+        hash = ((hash << 31) | (hash >> 33)) * 0xff51afd7ed558ccdULL;
+        p += (len < 8 ? len : 8);
+        len -= (len < 8 ? len : 8);
+    }
+
+    // Mix the last words into every bit.
+    //
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+
+}
+
+
+// *****************************************************************************
+// 
+// worldChecksum(struct World *world)
+//
+// Purpose: Hash the Rooms, adjacency list and string table of a World,
+//          as they are stored in a world file.
+//
+// *****************************************************************************
+//
+static uint64_t worldChecksum(struct World *world) {
+
+    uint64_t hash = WORLD_VERSION;   // running hash of the sections
+
+    hash = hashBytes(world->rooms, sizeof(struct Room) * world->numRooms,
+                     hash);
+    hash = hashBytes(world->adjList, sizeof(int32_t) * world->numAdj, hash);
+    hash = hashBytes(world->names, world->namesSize, hash);
+
+    return hash;
+
+}
+
+
+// *****************************************************************************
+// 
+// worldKey(struct GenParams *params)
+//
+// Purpose: Hash the parameters that decide what a new World looks like.
+//
+// *****************************************************************************
+//
+uint64_t worldKey(struct GenParams *params) {
+
+    uint64_t fields[7];  // everything the World depends on
+
+    fields[0] = WORLD_VERSION;
+    fields[1] = GENERATOR_VERSION;
+    fields[2] = params->seed;
+    fields[3] = params->numRooms;
+    fields[4] = params->generator;
+    fields[5] = params->minDegree;
+    fields[6] = params->maxDegree;
+
+    return hashBytes(fields, sizeof(fields), 0);
+
+}
+
+
+// *****************************************************************************
+// 
+// writeWorld(struct World *world, char fileName[], uint64_t key)
+//
+// Purpose: Output the whole World to a single binary world file.
+//
+// *****************************************************************************
+//
+int writeWorld(struct World *world, char fileName[], uint64_t key) {
+
+    FILE *fp = NULL;             // output file pointer
+
+    char tmpName[MAX_PATH_CHARS]; // where the file is written first
+
+    struct WorldHeader header;   // describes the sections that follow
+
+    static const char padding[8] = {0}; // zeros written between sections
+
+    // Lay out the sections one after another, each one aligned so that
+    // the mapped arrays can be used directly.
+    //
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WORLD_MAGIC, sizeof(WORLD_MAGIC));
+    header.version = WORLD_VERSION;
+    header.numRooms = world->numRooms;
+    header.numAdj = world->numAdj;
+    header.namesSize = world->namesSize;
+    header.roomsOffset = alignOffset(sizeof(header));
+    header.adjOffset = alignOffset(header.roomsOffset +
+                           (uint64_t) world->numRooms * sizeof(struct Room));
+    header.namesOffset = alignOffset(header.adjOffset +
+                           (uint64_t) world->numAdj * sizeof(int32_t));
+    header.key = key;
+    header.checksum = worldChecksum(world);
+
+    // Open a file of its own for writing. It only takes fileName once it
+    // is complete.
+    //
+    snprintf(tmpName, MAX_PATH_CHARS, "%s.tmp.%ld", fileName,
+             (long) getpid());
+    fp = fopen(tmpName, "wb");
+
+    // If there was a problem, exit with an error.
+    //
+    if(fp == NULL) {
+        printf("Error opening %s: errno = %d\n", tmpName, errno);
+        return 1;
+    }
+
+    // Write the header and each section, padding up to the offsets that
+    // the header promises.
+    //
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(padding, header.roomsOffset - sizeof(header), 1, fp);
+    fwrite(world->rooms, sizeof(struct Room), world->numRooms, fp);
+    fwrite(padding, header.adjOffset - ftell(fp), 1, fp);
+    fwrite(world->adjList, sizeof(int32_t), world->numAdj, fp);
+    fwrite(padding, header.namesOffset - ftell(fp), 1, fp);
+    fwrite(world->names, 1, world->namesSize, fp);
+
+    STAT_ADD(filesOpened, 1);
+    STAT_ADD(bytesWritten, ftell(fp));
+
+    // Flush everything written above to disk before the file gets its
+    // name, then rename it into place and make the rename stick.
+    //
+    if(fflush(fp) != 0 || ferror(fp) != 0 || fsync(fileno(fp)) != 0) {
+        printf("Error writing %s: errno = %d\n", tmpName, errno);
+        fclose(fp);
+        unlink(tmpName);
+        return 1;
+    }
+    fclose(fp);
+    if(rename(tmpName, fileName) != 0) {
+        printf("Error renaming %s: errno = %d\n", tmpName, errno);
+        unlink(tmpName);
+        return 1;
+    }
+    if(syncParent(fileName) != 0) {
+        printf("Error syncing the directory of %s: errno = %d\n", fileName,
+               errno);
+        return 1;
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// mapWorld(struct World *world, char fileName[])
+//
+// Purpose: Map a binary world file into memory.
+//
+// *****************************************************************************
+//
+int mapWorld(struct World *world, char fileName[]) {
+
+    int fd;                      // world file descriptor
+
+    struct stat filestat;        // stat() information on the world file
+
+    struct WorldHeader *header;  // header at the start of the mapping
+
+    char *map;                   // start of the mapping
+
+    // Open the world file and find out how big it is.
+    //
+    fd = open(fileName, O_RDONLY);
+    STAT_ADD(filesOpened, 1);
+    STAT_ADD(statCalls, 1);
+    if(fd < 0 || fstat(fd, &filestat) != 0) {
+        printf("Error opening %s: errno = %d\n", fileName, errno);
+        if(fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    if((size_t) filestat.st_size < sizeof(struct WorldHeader)) {
+        printf("%s is not a world file\n", fileName);
+        close(fd);
+        return 1;
+    }
+
+    // Map the whole file read-only. The mapping stays valid after the
+    // file descriptor is closed.
+    //
+    map = mmap(NULL, filestat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        printf("Error mapping %s: errno = %d\n", fileName, errno);
+        return 1;
+    }
+
+    // Make sure this really is a world file this program can read, and
+    // that every section the header describes is inside the file. The
+    // Rooms themselves are trusted, just like the text Room files.
+    //
+    header = (struct WorldHeader *) map;
+    if(memcmp(header->magic, WORLD_MAGIC, sizeof(WORLD_MAGIC)) != 0 ||
+       header->version != WORLD_VERSION ||
+       header->roomsOffset + (uint64_t) header->numRooms *
+           sizeof(struct Room) > (uint64_t) filestat.st_size ||
+       header->adjOffset + (uint64_t) header->numAdj *
+           sizeof(int32_t) > (uint64_t) filestat.st_size ||
+       header->namesOffset + header->namesSize >
+           (uint64_t) filestat.st_size) {
+        printf("%s is not a usable world file\n", fileName);
+        munmap(map, filestat.st_size);
+        return 1;
+    }
+
+    STAT_ADD(bytesMapped, filestat.st_size);
+
+    // Point the World straight at the mapped sections.
+    //
+    world->numRooms = header->numRooms;
+    world->numAdj = header->numAdj;
+    world->namesSize = header->namesSize;
+    world->rooms = (struct Room *) (map + header->roomsOffset);
+    world->adjList = (int32_t *) (map + header->adjOffset);
+    world->names = map + header->namesOffset;
+    world->map = map;
+    world->mapSize = filestat.st_size;
+
+    // A file that was cut short or scribbled on would otherwise send
+    // the game off into nonsense, so check every byte of it.
+    //
+    if(worldChecksum(world) != header->checksum) {
+        printf("%s is damaged (checksum mismatch)\n", fileName);
+        munmap(map, filestat.st_size);
+        world->map = NULL;
+        world->mapSize = 0;
+        world->rooms = NULL;
+        world->adjList = NULL;
+        world->names = NULL;
+        return 1;
+    }
+
+    // The name index and adjacency bitset are not stored in the file.
+    // Building them only needs one pass over the Rooms, with no reading
+    // or parsing. They are the only things the World's Arena holds.
+    //
+    if(arenaInit(&world->arena, sizeof(struct NameSlot) * nameIndexSlots(
+                 world->numRooms) + sizeof(uint64_t) *
+                 adjBitsWords(world->numRooms) * world->numRooms + 2 * 8) != 0 ||
+       buildNameIndex(world) != 0 || buildAdjBits(world) != 0) {
+        printf("Error allocating the index for %d Rooms\n", world->numRooms);
+        return 1;
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// loadCachedWorld(struct World *world, struct GenParams *params,
+//                 char cacheDir[], char *roomNames[])
+//
+// Purpose: Map a World from the cache, building it there on a miss.
+//
+// *****************************************************************************
+//
+int loadCachedWorld(struct World *world, struct GenParams *params,
+                    char cacheDir[], char *roomNames[]) {
+
+    uint64_t key;                // names the World in the cache
+
+    char fileName[MAX_PATH_CHARS]; // the cached world file
+
+    struct stat filestat;        // stat() information on the world file
+
+    double phaseStart;           // when the phase being timed began
+
+    key = worldKey(params);
+    snprintf(fileName, MAX_PATH_CHARS, "%s/%016llx.world", cacheDir,
+             (unsigned long long) key);
+
+    // A hit only costs mapping (and checking) one file. A file that
+    // fails its checksum, or somehow holds another World, is built
+    // again.
+    //
+    STAT_ADD(statCalls, 1);
+    if(stat(fileName, &filestat) == 0) {
+        phaseStart = statsStart();
+        if(mapWorld(world, fileName) == 0 &&
+           ((struct WorldHeader *) world->map)->key == key) {
+            statsStop(LOAD_PHASE, phaseStart);
+            return 0;
+        }
+        statsStop(LOAD_PHASE, phaseStart);
+        cleanRooms(world);
+        fprintf(stderr, "CACHE: building %s again\n", fileName);
+    }
+
+    // A miss: build the World. writeWorld() only puts the file in place
+    // once it is complete, so other runs never map half a World.
+    //
+    if(mkdir(cacheDir, 0755) == 0) {
+        STAT_ADD(dirsCreated, 1);
+    } else if(errno != EEXIST) {
+        printf("Error creating %s: errno = %d\n", cacheDir, errno);
+        return 1;
+    }
+    if(setupRooms(world, params, fileName, roomNames, BINARY_FORMAT) != 0) {
+        return 1;
+    }
+
+    phaseStart = statsStart();
+    if(mapWorld(world, fileName) != 0) {
+        return 1;
+    }
+    statsStop(LOAD_PHASE, phaseStart);
+
+    return 0;
+
+}
+
+
+// enum lineType: What nextLine() found on a line of a Room file (or of a
+// manifest, which adds the START_LINE).
+//
+enum lineType { NAME_LINE, CONNECTION_LINE, TYPE_LINE, DISTANCE_LINE,
+                START_LINE, OTHER_LINE, END_OF_BUFFER };
+
+
+// *****************************************************************************
+// 
+// readWhole(int fd, char **buf, size_t *bufSize)
+//
+// Purpose: Read a whole file into a buffer that is reused from file to
+//          file, growing it if the file does not fit. Returns the number
+//          of bytes read, or -1 for error.
+//
+// *****************************************************************************
+//
+static long readWhole(int fd, char **buf, size_t *bufSize) {
+
+    size_t used = 0;     // bytes read so far
+    ssize_t got;         // bytes returned by the last read()
+    char *grown;         // buf after growing it
+
+    for(;;) {
+        got = read(fd, *buf + used, *bufSize - used);
+        if(got < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        used += got;
+
+        // A regular file only comes up short at its end, so a file that
+        // fits in the buffer takes a single read().
+        //
+        if(used < *bufSize) {
+            return (long) used;
+        }
+
+        grown = (char *) realloc(*buf, *bufSize * 2);
+        if(grown == NULL) {
+            return -1;
+        }
+        *buf = grown;
+        *bufSize *= 2;
+    }
+
+}
+
+
+// *****************************************************************************
+// 
+// sliceIs(const char *slice, int len, const char *word)
+//
+// Purpose: Check whether a slice of a buffer is exactly word.
+//
+// *****************************************************************************
+//
+static int sliceIs(const char *slice, int len, const char *word) {
+
+    return (len == (int) strlen(word) && memcmp(slice, word, len) == 0);
+
+}
+
+
+// *****************************************************************************
+// 
+// nextLine(char **cursor, char *end, char **value, int *valueLen)
+//
+// Purpose: Classify the line of a Room file at *cursor by its prefix
+//          ("ROOM NAME:", "CONNECTION n:", "ROOM TYPE:", "END DISTANCE:"
+//          or, in a manifest, "START ROOM:") and move
+//          *cursor to the next line. The text after the prefix is
+//          returned as a slice of the buffer in *value and *valueLen,
+//          so nothing is copied.
+//
+// *****************************************************************************
+//
+static enum lineType nextLine(char **cursor, char *end, char **value,
+                              int *valueLen) {
+
+    char *line = *cursor;    // start of the line
+    char *eol;               // end of the line, trailing blanks trimmed
+    char *p;                 // start of the value
+
+    enum lineType type;      // what the line turned out to be
+
+    if(line >= end) {
+        return END_OF_BUFFER;
+    }
+
+    // Find the end of the line and step past it for the next call.
+    //
+    eol = (char *) memchr(line, '\n', end - line);
+    if(eol == NULL) {
+        eol = end;
+    }
+    *cursor = (eol < end ? eol + 1 : end);
+    while(eol > line && (eol[-1] == ' ' || eol[-1] == '\t' ||
+                         eol[-1] == '\r')) {
+        eol--;
+    }
+
+    // Match the prefix. A CONNECTION line carries its number before the
+    // colon, so skip over the digits.
+    //
+    if(eol - line >= 10 && memcmp(line, "ROOM NAME:", 10) == 0) {
+        type = NAME_LINE;
+        p = line + 10;
+    } else if(eol - line >= 10 && memcmp(line, "ROOM TYPE:", 10) == 0) {
+        type = TYPE_LINE;
+        p = line + 10;
+    } else if(eol - line >= 13 && memcmp(line, "END DISTANCE:", 13) == 0) {
+        type = DISTANCE_LINE;
+        p = line + 13;
+    } else if(eol - line >= 11 && memcmp(line, "START ROOM:", 11) == 0) {
+        type = START_LINE;
+        p = line + 11;
+    } else if(eol - line >= 11 && memcmp(line, "CONNECTION ", 11) == 0) {
+        p = line + 11;
+        while(p < eol && *p >= '0' && *p <= '9') {
+            p++;
+        }
+        if(p == eol || *p != ':') {
+            return OTHER_LINE;
+        }
+        type = CONNECTION_LINE;
+        p++;
+    } else {
+        return OTHER_LINE;
+    }
+
+    while(p < eol && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    *value = p;
+    *valueLen = eol - p;
+
+    return type;
+
+}
+
+
+// *****************************************************************************
+// 
+// addName(char ***names, int *count, int *size, const char *name, int len)
+//
+// Purpose: Append a copy of a Room name to a growable list of names.
+//
+// *****************************************************************************
+//
+static void addName(char ***names, int *count, int *size, const char *name,
+                    int len) {
+
+    char **newNames;          // names[] after growing it
+
+    // Grow the names array as needed. The room count is not known
+    // until the whole directory (or manifest) has been read.
+    //
+    if(*count == *size) {
+        *size = (*size == 0 ? 16 : *size * 2);
+        newNames = (char **) realloc(*names, sizeof(char *) * *size);
+        if(newNames == NULL) {
+            printf("Error allocating %d Room names\n", *size);
+            exit(1);
+        }
+        *names = newNames;
+    }
+
+    (*names)[*count] = strndup(name, len);
+    if((*names)[*count] == NULL) {
+        printf("Error allocating %d Room names\n", *size);
+        exit(1);
+    }
+    (*count)++;
+
+}
+
+
+// *****************************************************************************
+// 
+// readManifest(int fd, char ***names, int *count, int *numShards,
+//              char **startName)
+//
+// Purpose: Read the list of Rooms, the number of subdirectories and the
+//          START ROOM's name (NULL if it is not listed) from a sharded
+//          directory's manifest. Returns 0 for success, 1 for error.
+//
+// *****************************************************************************
+//
+static int readManifest(int fd, char ***names, int *count, int *numShards,
+                        char **startName) {
+
+    int size = 0;             // number of slots allocated in names[]
+
+    char *buf;                // whole contents of the manifest
+    size_t bufSize = 4096;    // bytes allocated for buf[]
+    long len;                 // bytes of buf[] holding the manifest
+
+    char *cursor;             // next line of buf[] to parse
+    char *value;              // Room name on a line (not copied)
+    int valueLen;             // length of value
+
+    buf = (char *) malloc(bufSize);
+    if(buf == NULL) {
+        return 1;
+    }
+    len = readWhole(fd, &buf, &bufSize);
+    if(len < 0) {
+        free(buf);
+        return 1;
+    }
+    STAT_ADD(bytesRead, len);
+
+    // The first line says how many subdirectories there are. readWhole()
+    // always leaves a spare byte, so the number can be parsed in place.
+    //
+    buf[len] = '\0';
+    if(len < 7 || memcmp(buf, "SHARDS:", 7) != 0) {
+        free(buf);
+        return 1;
+    }
+    *numShards = (int) strtol(buf + 7, NULL, 10);
+    if(*numShards < 1 || *numShards > MAX_SHARDS) {
+        free(buf);
+        return 1;
+    }
+
+    // Every other line names one Room, in index order.
+    //
+    cursor = buf;
+    for(;;) {
+        switch(nextLine(&cursor, buf + len, &value, &valueLen)) {
+            case NAME_LINE:
+                addName(names, count, &size, value, valueLen);
+                break;
+            case START_LINE:
+                free(*startName);
+                *startName = strndup(value, valueLen);
+                break;
+            case END_OF_BUFFER:
+                free(buf);
+                return 0;
+            default:
+                break;
+        }
+    }
+
+}
+
+
+// *****************************************************************************
+// 
+// scanRooms(struct World *world, DIR *dp, char dirName[], int *numShards)
+//
+// Purpose: Find out which Rooms a text Room file directory holds, from
+//          its manifest or by scanning it, and set up the World's Room
+//          array, string table and name index for them. Nothing is read
+//          from the Room files. Returns the index of the START ROOM if
+//          the manifest names it, otherwise -1.
+//
+// *****************************************************************************
+//
+static int scanRooms(struct World *world, DIR *dp, char dirName[],
+                     int *numShards) {
+
+    int i;                    // loop iterator
+    int roomCount;            // number of Room files read so far
+    int namesSize;            // number of slots allocated in readRoomNames[]
+    int startRoom = -1;       // the START ROOM, if the manifest says
+
+    char **readRoomNames = NULL; // Room names read in from the directory
+    char *startName = NULL;   // name of the START ROOM from the manifest
+
+    int fd;                   // manifest file descriptor
+    int dirFd = dirfd(dp);    // descriptor of the open directory
+    struct dirent *dirFiles;  // struct that holds directory data
+
+    int isFile;               // whether a directory entry is a regular file
+
+    struct stat filestat;     // fstatat() information on a directory entity
+
+    //
+    // *******************************************************************
+    // Fill the readRoomNames array with the Room names. We need to do
+    // this to have an indexable list of rooms for navigation.
+    // *******************************************************************
+    //
+
+    // Start with no Rooms read.
+    //
+    roomCount = 0;
+    namesSize = 0;
+    *numShards = 0;
+
+    // A sharded directory lists its Rooms in the manifest, so there is
+    // no directory to scan.
+    //
+    fd = openat(dirFd, MANIFEST_NAME, O_RDONLY);
+    if(fd >= 0) {
+        STAT_ADD(filesOpened, 1);
+        if(readManifest(fd, &readRoomNames, &roomCount, numShards,
+                        &startName) != 0) {
+            printf("Error reading %s/%s: errno = %d\n", dirName,
+                   MANIFEST_NAME, errno);
+            exit(1);
+        }
+        close(fd);
+    }
+
+    // Otherwise read Room files from the output directory.
+    //
+    while(fd < 0 && (dirFiles = readdir(dp)) != NULL) {
+
+        // Each time readdir() runs, another entity is read from the
+        // output directory. If the file is a regular file and not a
+        // dotfile (".", ".." or the manifest) add it to the array that
+        // holds room names.
+        //
+        // Most filesystems say what kind of file an entry is right in
+        // d_type, which saves a stat per file. DT_REG is not POSIX, so
+        // fall back to fstatat() and S_ISREG() where d_type is missing,
+        // unknown or a symbolic link that has to be followed.
+        //
+        STAT_ADD(dirEntries, 1);
+        if(dirFiles->d_name[0] == '.') {
+            continue;
+        }
+        isFile = -1;
+#ifdef DT_REG
+        if(dirFiles->d_type == DT_REG) {
+            isFile = 1;
+        } else if(dirFiles->d_type != DT_UNKNOWN &&
+                  dirFiles->d_type != DT_LNK) {
+            isFile = 0;
+        }
+#endif
+        if(isFile < 0) {
+            STAT_ADD(statCalls, 1);
+            isFile = (fstatat(dirFd, dirFiles->d_name, &filestat, 0) == 0 &&
+                      S_ISREG(filestat.st_mode));
+        }
+        if(isFile == 0) {
+            continue;
+        }
+
+        // readdir() may reuse d_name for the next entry, so keep a copy.
+        //
+        addName(&readRoomNames, &roomCount, &namesSize, dirFiles->d_name,
+                strlen(dirFiles->d_name));
+    }
+
+    //
+    // The readRoomNames[] array has been populated. We now have a new
+    // ordering for the rooms in readRoomNames[] (based on the order in
+    // which they were read in from the output directory) so the adjacent
+    // room mapping will need to be indexed based on the position of Room
+    // names in readRoomNames[].
+    //
+
+    world->numRooms = roomCount;
+    world->namesSize = 0;
+    for(i = 0; i < roomCount; i++) {
+        world->namesSize += strlen(readRoomNames[i]) + 1;
+    }
+    world->rooms = (struct Room *) calloc(roomCount > 0 ? roomCount : 1,
+                                          sizeof(struct Room));
+    world->names = (char *) malloc(world->namesSize + 1);
+    if(world->rooms == NULL || world->names == NULL) {
+        printf("Error allocating %d Rooms\n", roomCount);
+        exit(1);
+    }
+
+    // The file names are the Room names, so they go into the string
+    // table in the same order.
+    //
+    world->namesSize = 0;
+    for(i = 0; i < roomCount; i++) {
+        world->rooms[i].nameOff = world->namesSize;
+        strcpy(world->names + world->namesSize, readRoomNames[i]);
+        world->namesSize += strlen(readRoomNames[i]) + 1;
+    }
+
+    // Index the names once so every CONNECTION line (and later every
+    // move) is a single hash lookup instead of a walk over all names.
+    //
+    if(buildNameIndex(world) != 0) {
+        printf("Error allocating the index for %d Rooms\n", roomCount);
+        exit(1);
+    }
+    if(startName != NULL) {
+        startRoom = findRoom(world, startName);
+        free(startName);
+    }
+
+    // The names have all been matched up with Rooms, so the copies are
+    // no longer needed.
+    //
+    for(i = 0; i < roomCount; i++) {
+        free(readRoomNames[i]);
+    }
+    free(readRoomNames);
+
+    return startRoom;
+
+}
+
+
+// *****************************************************************************
+// 
+// parseRoom(struct World *world, int room, struct RoomDir *dir,
+//           char **buf, size_t *bufSize, int32_t **adj, int *numAdj,
+//           int *adjSize)
+//
+// Purpose: Read one Room's file into buf[] and parse it. The Room's type
+//          and adjCount are filled in, and its connections are appended
+//          to the growable list adj[], with adjStart set to where they
+//          begin in it. Returns the number of bytes read.
+//
+// *****************************************************************************
+//
+static long parseRoom(struct World *world, int room, struct RoomDir *dir,
+                      char **buf, size_t *bufSize, int32_t **adj,
+                      int *numAdj, int *adjSize) {
+
+    int x;                    // Room named on a CONNECTION line
+    int fd;                   // Room file descriptor
+    int dist;                 // number on an END DISTANCE line
+    long fileLen;             // bytes of buf[] holding the file
+    int32_t *newAdj;          // adj[] after growing it
+
+    char *cursor;             // next line of buf[] to parse
+    char *value;              // text after a line's prefix (not copied)
+    int valueLen;             // length of value
+
+    struct Room *newRoom = &world->rooms[room]; // Room being read in
+
+    enum lineType lineType;   // what nextLine() found
+
+    // Open the Room file relative to its directory and read all of it at
+    // once.
+    //
+    fd = openat(roomDirFd(dir, roomName(world, room)), roomName(world, room),
+                O_RDONLY);
+
+    // If there was a problem opening or reading the Room file, exit with
+    // an error.
+    //
+    if(fd < 0) {
+        printf("Error opening %s/%s: errno = %d\n", dir->dirName,
+               roomName(world, room), errno);
+        exit(1);
+    }
+
+    STAT_ADD(filesOpened, 1);
+
+    fileLen = readWhole(fd, buf, bufSize);
+    if(fileLen < 0) {
+        printf("Error reading %s/%s: errno = %d\n", dir->dirName,
+               roomName(world, room), errno);
+        exit(1);
+    }
+    close(fd);
+
+    // The Room's adjacent Rooms start at the end of adj[] and grow as
+    // CONNECTION lines are read.
+    //
+    newRoom->adjStart = *numAdj;
+    newRoom->adjCount = 0;
+    newRoom->endDist = DIST_UNKNOWN;
+    newRoom->type = -1;
+
+    // Walk the lines in the buffer. The "NAME" line always matches the
+    // file name, which is already in the string table, so only CONNECTION
+    // and TYPE lines matter.
+    //
+    cursor = *buf;
+    for(;;) {
+        lineType = nextLine(&cursor, *buf + fileLen, &value, &valueLen);
+        if(lineType == END_OF_BUFFER) {
+            break;
+        }
+
+        if(lineType == TYPE_LINE) {
+            if(sliceIs(value, valueLen, "START_ROOM")) {
+                newRoom->type = START_ROOM;
+            } else if(sliceIs(value, valueLen, "MID_ROOM")) {
+                newRoom->type = MID_ROOM;
+            } else if(sliceIs(value, valueLen, "END_ROOM")) {
+                newRoom->type = END_ROOM;
+            }
+        } else if(lineType == DISTANCE_LINE) {
+            // The value is not NUL terminated, so read the digits by hand.
+            // NO_DISTANCE is the only negative number ever written.
+            //
+            if(sliceIs(value, valueLen, "-1")) {
+                newRoom->endDist = NO_DISTANCE;
+            } else if(valueLen > 0 && valueLen < 10) {
+                dist = 0;
+                for(x = 0; x < valueLen && value[x] >= '0' &&
+                           value[x] <= '9'; x++) {
+                    dist = dist * 10 + (value[x] - '0');
+                }
+                if(x == valueLen) {
+                    newRoom->endDist = dist;
+                }
+            }
+        } else if(lineType == CONNECTION_LINE) {
+            // For each "CONNECTION", look up the adjacent Room name in the
+            // name index and, if you get a match, append its index to
+            // adj[] to mark the room as adjacent.
+            //
+            // Do not mark the current Room as adjacent in the adjacent
+            // room's list!  That was only necessary when setting up the
+            // Room files in setupRooms().
+            //
+            x = findRoomLen(world, value, valueLen);
+            if(x >= 0) {
+                if(*numAdj == *adjSize) {
+                    *adjSize = (*adjSize > 0 ? *adjSize * 2 : 16);
+                    newAdj = (int32_t *) realloc(*adj,
+                                                 sizeof(int32_t) * *adjSize);
+                    if(newAdj == NULL) {
+                        printf("Error allocating %d connections\n",
+                               *adjSize);
+                        exit(1);
+                    }
+                    *adj = newAdj;
+                }
+                (*adj)[(*numAdj)++] = x;
+                newRoom->adjCount++;
+            }
+        }
+    }
+
+    // A Room file without a ROOM TYPE line was never finished (or was
+    // not written by this program), and a Room of no type would break
+    // the game, so refuse it.
+    //
+    if(newRoom->type < 0) {
+        printf("Error reading %s/%s: no ROOM TYPE\n", dir->dirName,
+               roomName(world, room));
+        exit(1);
+    }
+
+    return fileLen;
+
+}
+
+
+// struct ReadTask: One worker thread's share of readRooms(). Each worker
+// parses the files for Rooms first through last-1 into its own adjList[],
+// numbering adjStart from 0; readRooms() glues the lists together in
+// Room order afterward.
+//
+struct ReadTask {
+    struct World *world;
+    struct RoomDir *dir;
+    int first;
+    int last;
+    int32_t *adjList;
+    int numAdj;
+};
+
+
+// *****************************************************************************
+// 
+// readWorker(void *arg)
+//
+// Purpose: Read and parse the Room files for one worker's Rooms.
+//
+// *****************************************************************************
+//
+static void *readWorker(void *arg) {
+
+    struct ReadTask *task = (struct ReadTask *) arg;
+
+    int i;                    // loop iterator
+    int adjSize;              // number of slots allocated in adjList[]
+
+    char *fileBuf;            // whole contents of the Room file being read
+    size_t bufSize = 4096;    // bytes allocated for fileBuf[]
+    long long readBytes = 0;  // bytes read from all the worker's files
+
+    // Every Room file is read into the same buffer.
+    //
+    adjSize = (task->last - task->first) * MIN_ADJ * 2;
+    task->adjList = (int32_t *) malloc(sizeof(int32_t) *
+                                       (adjSize > 0 ? adjSize : 1));
+    fileBuf = (char *) malloc(bufSize);
+    if(task->adjList == NULL || fileBuf == NULL) {
+        printf("Error allocating %d connections\n", adjSize);
+        exit(1);
+    }
+    task->numAdj = 0;
+
+    // For each file, open the file and read its contents.
+    //
+    for(i = task->first; i < task->last; i++) {
+        readBytes += parseRoom(task->world, i, task->dir, &fileBuf, &bufSize,
+                               &task->adjList, &task->numAdj, &adjSize);
+    }
+
+    free(fileBuf);
+    STAT_ADD(bytesRead, readBytes);
+
+    return NULL;
+
+}
+
+
+// *****************************************************************************
+// 
+// readRooms(struct World *world, char dirName[], int numThreads)
+//
+// Purpose: Read Room data in from files.
+//
+// *****************************************************************************
+//
+int readRooms(struct World *world, char dirName[], int numThreads) {
+
+    int i, t;                 // loop iterators
+    int numTasks;             // number of worker threads
+    int numShards;            // number of subdirectories, 0 if not sharded
+
+    DIR  *dp = NULL;          // directory pointer
+
+    struct RoomDir dir;       // where the Room files are
+
+    struct ReadTask tasks[MAX_THREADS]; // one per worker thread
+
+    // Open the output file directory.
+    //
+    dp = opendir(dirName);
+
+    // If there was a problem opening the output file directory, exit with
+    // an error.
+    //
+    if(dp == NULL) {
+        printf("Error opening %s: errno = %d\n", dirName, errno);
+        exit(1);
+    }
+
+    // Learn the Room names, then open the subdirectories once for all
+    // the workers.
+    //
+    scanRooms(world, dp, dirName, &numShards);
+    if(world->numRooms == 0) {
+        printf("Error: %s holds no Rooms\n", dirName);
+        closedir(dp);
+        return 1;
+    }
+    openRoomDir(&dir, dirName, dirfd(dp), numShards, 0);
+
+    // Each worker parses the files for an even share of the Rooms. The
+    // name index is only read from here on, so they can share it.
+    //
+    numTasks = (numThreads < world->numRooms ? numThreads : world->numRooms);
+    for(t = 0; t < numTasks; t++) {
+        tasks[t].world = world;
+        tasks[t].dir = &dir;
+        tasks[t].first = (int) ((long long) world->numRooms * t / numTasks);
+        tasks[t].last = (int) ((long long) world->numRooms * (t + 1) / numTasks);
+    }
+    runWorkers(readWorker, tasks, sizeof(struct ReadTask), numTasks);
+
+    // Glue the workers' adjacency lists together in Room order and move
+    // each Room's adjStart from its worker's list to the whole list.
+    //
+    world->numAdj = 0;
+    for(t = 0; t < numTasks; t++) {
+        world->numAdj += tasks[t].numAdj;
+    }
+    world->adjList = (int32_t *) malloc(sizeof(int32_t) *
+                                        (world->numAdj > 0 ? world->numAdj : 1));
+    if(world->adjList == NULL) {
+        printf("Error allocating %d connections\n", world->numAdj);
+        exit(1);
+    }
+    world->numAdj = 0;
+    for(t = 0; t < numTasks; t++) {
+        memcpy(world->adjList + world->numAdj, tasks[t].adjList,
+               sizeof(int32_t) * tasks[t].numAdj);
+        for(i = tasks[t].first; i < tasks[t].last; i++) {
+            world->rooms[i].adjStart += world->numAdj;
+        }
+        world->numAdj += tasks[t].numAdj;
+        free(tasks[t].adjList);
+    }
+
+    // Close the subdirectories and the output directory.
+    //
+    closeRoomDir(&dir);
+    closedir(dp);
+
+    // Files written before distances were kept (or edited by hand) lack
+    // some of them, so work them all out again.
+    //
+    for(i = 0; i < world->numRooms &&
+               world->rooms[i].endDist != DIST_UNKNOWN; i++) {
+    }
+    if(i < world->numRooms && computeDistances(world) != 0) {
+        printf("Error allocating %d Rooms\n", world->numRooms);
+        exit(1);
+    }
+
+    // Gather the finished World into one block of memory.
+    //
+    if(packWorld(world) != 0) {
+        printf("Error allocating %d Rooms\n", world->numRooms);
+        exit(1);
+    }
+
+    // A World nobody can start in is as good as no World.
+    //
+    if(findStartRoom(world) < 0) {
+        printf("Error: %s has no START ROOM\n", dirName);
+        return 1;
+    }
+
+    return 0;
+
+}
+
+
+// enum loadState: How far along a Room of a lazily loaded World is.
+//
+enum loadState { UNLOADED, LOADING, LOADED };
+
+
+// struct Lazy: What a World loaded by readRoomsLazy() needs to load its
+// Rooms as they are reached.
+//
+// dp, dir      -> The open Room file directory.
+//
+// state[]      -> A loadState for every Room. A Room's type, adjStart
+//                 and adjCount may only be used once it is LOADED.
+//
+// startRoom    -> Index of the START ROOM.
+//
+// adjSize      -> Number of slots allocated in world->adjList[].
+//
+// retired[]    -> Earlier, smaller copies of world->adjList[]. The list
+//                 is copied when it grows, and a thread may still be
+//                 reading an old copy, so they are only freed along with
+//                 the World. Doubling means there are never more than 32.
+//
+// lock         -> Guards state[], growing adjList[] and the prefetch
+//                 request. loaded is signalled whenever a Room finishes
+//                 loading, wake whenever there is a new request or it is
+//                 time to stop.
+//
+// prefetchRoom -> Room whose neighbours the prefetcher should load next,
+//                 or -1 for none.
+//
+struct Lazy {
+    DIR *dp;
+    struct RoomDir dir;
+    unsigned char *state;
+    int startRoom;
+    int adjSize;
+    int32_t *retired[32];
+    int numRetired;
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    pthread_cond_t wake;
+    pthread_t prefetcher;
+    int prefetchRoom;
+    int stop;
+};
+
+
+// *****************************************************************************
+// 
+// loadRoom(struct World *world, int room)
+//
+// Purpose: Make sure a Room of a lazily loaded World is loaded.
+//
+// *****************************************************************************
+//
+void loadRoom(struct World *world, int room) {
+
+    struct Lazy *lazy = world->lazy;
+
+    int32_t *adj = NULL;      // the Room's connections, as parsed
+    int numAdj = 0;           // number of connections in adj[]
+    int adjSize = 0;          // number of slots allocated in adj[]
+    int newSize;              // size of world->adjList[] after growing it
+    int32_t *grown;           // world->adjList[] after growing it
+
+    char *fileBuf;            // whole contents of the Room file
+    size_t bufSize = 4096;    // bytes allocated for fileBuf[]
+    long readBytes;           // bytes read from the Room file
+
+    // Nothing to do for a fully loaded World or a Room already in.
+    //
+    if(lazy == NULL ||
+       __atomic_load_n(&lazy->state[room], __ATOMIC_ACQUIRE) == LOADED) {
+        return;
+    }
+
+    // Claim the Room, or wait for whoever already has.
+    //
+    pthread_mutex_lock(&lazy->lock);
+    while(lazy->state[room] == LOADING) {
+        pthread_cond_wait(&lazy->loaded, &lazy->lock);
+    }
+    if(lazy->state[room] == LOADED) {
+        pthread_mutex_unlock(&lazy->lock);
+        return;
+    }
+    lazy->state[room] = LOADING;
+    pthread_mutex_unlock(&lazy->lock);
+
+    // Read the file without holding the lock, so the player and the
+    // prefetcher can each load a different Room at the same time.
+    //
+    fileBuf = (char *) malloc(bufSize);
+    if(fileBuf == NULL) {
+        printf("Error allocating a %d byte read buffer\n", (int) bufSize);
+        exit(1);
+    }
+    readBytes = parseRoom(world, room, &lazy->dir, &fileBuf, &bufSize, &adj,
+                          &numAdj, &adjSize);
+    STAT_ADD(bytesRead, readBytes);
+    free(fileBuf);
+
+    // Append the connections to adjList[]. When it has to grow, the new
+    // copy is published with a single pointer store and the old one is
+    // kept, so a thread walking a Room it already has never notices.
+    //
+    pthread_mutex_lock(&lazy->lock);
+    if(world->numAdj + numAdj > lazy->adjSize) {
+        newSize = lazy->adjSize * 2;
+        while(world->numAdj + numAdj > newSize) {
+            newSize *= 2;
+        }
+        grown = (int32_t *) malloc(sizeof(int32_t) * newSize);
+        if(grown == NULL) {
+            printf("Error allocating %d connections\n", newSize);
+            exit(1);
+        }
+        memcpy(grown, world->adjList, sizeof(int32_t) * world->numAdj);
+        lazy->retired[lazy->numRetired++] = world->adjList;
+        __atomic_store_n(&world->adjList, grown, __ATOMIC_RELEASE);
+        lazy->adjSize = newSize;
+    }
+    if(numAdj > 0) {
+        memcpy(world->adjList + world->numAdj, adj, sizeof(int32_t) * numAdj);
+    }
+    world->rooms[room].adjStart = world->numAdj;
+    world->numAdj += numAdj;
+    __atomic_store_n(&lazy->state[room], LOADED, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&lazy->loaded);
+    pthread_mutex_unlock(&lazy->lock);
+
+    free(adj);
+
+}
+
+
+// *****************************************************************************
+// 
+// prefetchRooms(struct World *world, int room)
+//
+// Purpose: Ask the prefetcher to load a Room's neighbours.
+//
+// *****************************************************************************
+//
+void prefetchRooms(struct World *world, int room) {
+
+    struct Lazy *lazy = world->lazy;
+
+    if(lazy == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&lazy->lock);
+    __atomic_store_n(&lazy->prefetchRoom, room, __ATOMIC_RELAXED);
+    pthread_cond_signal(&lazy->wake);
+    pthread_mutex_unlock(&lazy->lock);
+
+}
+
+
+// *****************************************************************************
+// 
+// prefetchWorker(void *arg)
+//
+// Purpose: Background thread of a lazily loaded World. It loads the
+//          neighbours of whichever Room prefetchRooms() last named, so
+//          they are in by the time the player picks one.
+//
+// *****************************************************************************
+//
+static void *prefetchWorker(void *arg) {
+
+    struct World *world = (struct World *) arg;
+    struct Lazy *lazy = world->lazy;
+
+    int x;                    // loop iterator
+    int room;                 // Room whose neighbours are being loaded
+    int32_t *adjList;         // world->adjList[] as it was after loading it
+
+    pthread_mutex_lock(&lazy->lock);
+    while(lazy->stop == 0) {
+        if(lazy->prefetchRoom < 0) {
+            pthread_cond_wait(&lazy->wake, &lazy->lock);
+            continue;
+        }
+        room = lazy->prefetchRoom;
+        __atomic_store_n(&lazy->prefetchRoom, -1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&lazy->lock);
+
+        // Drop the rest of the neighbours as soon as the player moves
+        // on (a newer request) or leaves.
+        //
+        loadRoom(world, room);
+        adjList = __atomic_load_n(&world->adjList, __ATOMIC_ACQUIRE);
+        for(x = 0; x < world->rooms[room].adjCount; x++) {
+            if(__atomic_load_n(&lazy->prefetchRoom, __ATOMIC_RELAXED) >= 0 ||
+               __atomic_load_n(&lazy->stop, __ATOMIC_RELAXED) != 0) {
+                break;
+            }
+            loadRoom(world, adjList[world->rooms[room].adjStart + x]);
+        }
+
+        pthread_mutex_lock(&lazy->lock);
+    }
+    pthread_mutex_unlock(&lazy->lock);
+
+    return NULL;
+
+}
+
+
+// *****************************************************************************
+// 
+// readRoomsLazy(struct World *world, char dirName[])
+//
+// Purpose: Get a text World ready to play without reading its Room files.
+//
+// *****************************************************************************
+//
+int readRoomsLazy(struct World *world, char dirName[]) {
+
+    int i;                    // loop iterator
+    int numShards;            // number of subdirectories, 0 if not sharded
+
+    struct Lazy *lazy;        // the World's lazy loading state
+
+    // Open the output file directory and learn the Room names. The
+    // directory stays open until the World is cleaned up.
+    //
+    lazy = (struct Lazy *) calloc(1, sizeof(struct Lazy));
+    if(lazy == NULL) {
+        printf("Error allocating the lazy loader\n");
+        exit(1);
+    }
+    lazy->dp = opendir(dirName);
+    if(lazy->dp == NULL) {
+        printf("Error opening %s: errno = %d\n", dirName, errno);
+        exit(1);
+    }
+    lazy->startRoom = scanRooms(world, lazy->dp, dirName, &numShards);
+    if(world->numRooms == 0) {
+        printf("Error: %s holds no Rooms\n", dirName);
+        closedir(lazy->dp);
+        free(lazy);
+        return 1;
+    }
+    openRoomDir(&lazy->dir, dirName, dirfd(lazy->dp), numShards, 0);
+
+    // Every Room starts out UNLOADED, with room in adjList[] for a
+    // handful of them.
+    //
+    lazy->state = (unsigned char *) calloc(world->numRooms > 0 ?
+                                           world->numRooms : 1, 1);
+    lazy->adjSize = 256;
+    world->numAdj = 0;
+    world->adjList = (int32_t *) malloc(sizeof(int32_t) * lazy->adjSize);
+    if(lazy->state == NULL || world->adjList == NULL) {
+        printf("Error allocating %d Rooms\n", world->numRooms);
+        exit(1);
+    }
+    pthread_mutex_init(&lazy->lock, NULL);
+    pthread_cond_init(&lazy->loaded, NULL);
+    pthread_cond_init(&lazy->wake, NULL);
+    lazy->prefetchRoom = -1;
+    world->lazy = lazy;
+
+    // Without a manifest nothing says which Room the game starts in, so
+    // load Rooms in order until the START ROOM turns up.
+    //
+    for(i = 0; lazy->startRoom < 0 && i < world->numRooms; i++) {
+        loadRoom(world, i);
+        if(world->rooms[i].type == START_ROOM) {
+            lazy->startRoom = i;
+        }
+    }
+    if(lazy->startRoom < 0) {
+        printf("Error: %s has no START ROOM\n", dirName);
+        return 1;
+    }
+
+    if(pthread_create(&lazy->prefetcher, NULL, prefetchWorker, world) != 0) {
+        printf("Error starting the prefetcher: errno = %d\n", errno);
+        exit(1);
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// stopLazy(struct World *world)
+//
+// Purpose: Stop the prefetcher of a lazily loaded World and free what
+//          only lazy loading uses.
+//
+// *****************************************************************************
+//
+static void stopLazy(struct World *world) {
+
+    struct Lazy *lazy = world->lazy;
+
+    int i;                    // loop iterator
+
+    pthread_mutex_lock(&lazy->lock);
+    __atomic_store_n(&lazy->stop, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&lazy->wake);
+    pthread_mutex_unlock(&lazy->lock);
+    pthread_join(lazy->prefetcher, NULL);
+
+    closeRoomDir(&lazy->dir);
+    closedir(lazy->dp);
+    for(i = 0; i < lazy->numRetired; i++) {
+        free(lazy->retired[i]);
+    }
+    free(lazy->state);
+    pthread_mutex_destroy(&lazy->lock);
+    pthread_cond_destroy(&lazy->loaded);
+    pthread_cond_destroy(&lazy->wake);
+    free(lazy);
+    world->lazy = NULL;
+
+}
+
+
+// Set by the SIGTERM handler of playGame() and playProtocol(), which
+// then save the game and stop.
+//
+static volatile sig_atomic_t checkpointStop = 0;
+
+
+// *****************************************************************************
+// 
+// checkpointSignal(int sig)
+//
+// Purpose: Ask a game with a checkpoint file to save and stop.
+//
+// *****************************************************************************
+//
+static void checkpointSignal(int sig) {
+
+    (void) sig;
+    checkpointStop = 1;
+
+}
+
+
+// *****************************************************************************
+// 
+// startCheckpoints(struct World *world, char saveName[],
+//                  char resumeName[], int startRoom, uint64_t *worldId,
+//                  int *currRoom, struct Path *path)
+//
+// Purpose: Get playGame() or playProtocol() ready for checkpoints: work
+//          out the World's id, pick up the saved game if there is one,
+//          and save on SIGTERM. A checkpoint that can not be picked up
+//          is an error.
+//
+// *****************************************************************************
+//
+static void startCheckpoints(struct World *world, char saveName[],
+                             char resumeName[], int startRoom,
+                             uint64_t *worldId, int *currRoom,
+                             struct Path *path) {
+
+    struct sigaction action;     // how SIGTERM is handled
+
+    if(saveName == NULL && resumeName == NULL) {
+        return;
+    }
+    *worldId = worldChecksum(world);
+
+    if(resumeName != NULL &&
+       loadCheckpoint(world, resumeName, *worldId, startRoom, currRoom,
+                      path) != 0) {
+        exit(1);
+    }
+
+    // Without SA_RESTART the signal also breaks the wait for input, so
+    // the game saves straight away rather than after the next line.
+    //
+    if(saveName != NULL) {
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = checkpointSignal;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGTERM, &action, NULL);
+    }
+
+}
+
+
+// *****************************************************************************
+// 
+// saveCheckpoint(char fileName[], uint64_t worldId, int startRoom,
+//                int currRoom, struct Path *path)
+//
+// Purpose: Save a game in progress.
+//
+// *****************************************************************************
+//
+int saveCheckpoint(char fileName[], uint64_t worldId, int startRoom,
+                   int currRoom, struct Path *path) {
+
+    int x;                       // loop iterator
+    int fd;                      // checkpoint file descriptor
+
+    char tmpName[MAX_PATH_CHARS]; // where the file is written first
+
+    struct Checkpoint save;      // the game, as written out
+
+    memset(&save, 0, sizeof(save));
+    memcpy(save.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    save.version = CHECKPOINT_VERSION;
+    save.worldId = worldId;
+    save.startRoom = startRoom;
+    save.currRoom = currRoom;
+    save.pathCount = path->pathCount;
+    for(x = 0; x < path->pathCount; x++) {
+        save.pathIdxs[x] = path->pathIdxs[x];
+    }
+
+    snprintf(tmpName, MAX_PATH_CHARS, "%s.tmp.%ld", fileName,
+             (long) getpid());
+    fd = open(tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        printf("Error opening %s: errno = %d\n", tmpName, errno);
+        return 1;
+    }
+    STAT_ADD(filesOpened, 1);
+    if(writeWhole(fd, (const char *) &save, sizeof(save)) != 0 ||
+       fsync(fd) != 0) {
+        printf("Error writing %s: errno = %d\n", tmpName, errno);
+        close(fd);
+        unlink(tmpName);
+        return 1;
+    }
+    close(fd);
+    STAT_ADD(bytesWritten, sizeof(save));
+
+    if(rename(tmpName, fileName) != 0) {
+        printf("Error renaming %s: errno = %d\n", tmpName, errno);
+        unlink(tmpName);
+        return 1;
+    }
+    if(syncParent(fileName) != 0) {
+        printf("Error syncing the directory of %s: errno = %d\n", fileName,
+               errno);
+        return 1;
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// loadCheckpoint(struct World *world, char fileName[], uint64_t worldId,
+//                int startRoom, int *currRoom, struct Path *path)
+//
+// Purpose: Pick up a saved game.
+//
+// *****************************************************************************
+//
+int loadCheckpoint(struct World *world, char fileName[], uint64_t worldId,
+                   int startRoom, int *currRoom, struct Path *path) {
+
+    int x;                       // loop iterator
+    int fd;                      // checkpoint file descriptor
+    int room;                    // Room the path has reached
+    ssize_t got;                 // bytes read
+
+    struct Checkpoint save;      // the game, as read back
+
+    fd = open(fileName, O_RDONLY);
+    if(fd < 0) {
+        printf("Error opening %s: errno = %d\n", fileName, errno);
+        return 1;
+    }
+    STAT_ADD(filesOpened, 1);
+    got = read(fd, &save, sizeof(save));
+    close(fd);
+    if(got > 0) {
+        STAT_ADD(bytesRead, got);
+    }
+
+    if(got != (ssize_t) sizeof(save) ||
+       memcmp(save.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 ||
+       save.version != CHECKPOINT_VERSION) {
+        printf("Error reading %s: not a checkpoint file\n", fileName);
+        return 1;
+    }
+    if(save.worldId != worldId) {
+        printf("Error reading %s: saved from another world\n", fileName);
+        return 1;
+    }
+
+    // Walk the saved path again from the START ROOM. Every step has to
+    // be a legal move, and the path has to end where the player is.
+    //
+    room = startRoom;
+    if(save.startRoom != startRoom || save.pathCount < 0 ||
+       save.pathCount > MAX_PATH) {
+        room = -1;
+    }
+    for(x = 0; room >= 0 && x < save.pathCount; x++) {
+        if(world->rooms[room].type == END_ROOM) {
+            room = -1;
+        } else {
+            room = moveRoomIndex(world, room, save.pathIdxs[x]);
+        }
+    }
+    if(room < 0 || room != save.currRoom) {
+        printf("Error reading %s: checkpoint is damaged\n", fileName);
+        return 1;
+    }
+
+    *currRoom = room;
+    path->pathCount = save.pathCount;
+    for(x = 0; x < save.pathCount; x++) {
+        path->pathIdxs[x] = save.pathIdxs[x];
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// playGame(struct World *world, char saveName[], char resumeName[])
+//
+// Purpose: Perform the actual game functionality.
+//
+// *****************************************************************************
+//
+int playGame(struct World *world, char saveName[], char resumeName[]) {
+
+    int i, x;            // loop iterators
+    int startRoom;       // where the game begins
+    int room;            // where the game picks up
+    int hint;            // Room suggested by the HINT command
+    int userInputLen;    // holds length of user input. Used to get rid of 
+                         //   trailing newline.
+
+    char userInput[MAX_INPUT_CHARS]; // holds string entered by user
+
+    uint64_t worldId = 0; // worldChecksum(), for checkpoints
+    uint32_t session;    // the game's number in the journal
+
+    int32_t *adj;        // the current Room's slice of adjList[]
+
+    // Initialize to -1 because 0 is a legitimate value.
+    //
+    int userInputIdx = -1;
+
+    // Set up a new Room struct to always point to the current Room.
+    //
+    struct Room *currRoom = NULL;
+
+    // Set up a new Path struct to track the rooms visited. Initialize the
+    // path indices to all be -1 (0 is a legitimate value so it can not be
+    // used to indicate an unvisited Room) and initialize the path count
+    // to 0 because we're just starting.
+    //
+    struct Path path = { {-1}, 0};
+
+    // Always start with START_ROOM, unless a saved game is picked up.
+    //
+    startRoom = findStartRoom(world);
+    if(startRoom < 0) {
+        printf("There is no START_ROOM. Nowhere to begin.\n");
+        return 1;
+    }
+    room = startRoom;
+    startCheckpoints(world, saveName, resumeName, startRoom, &worldId,
+                     &room, &path);
+    loadRoom(world, room);
+    currRoom = &world->rooms[room];
+    session = journalSession();
+    JOURNAL_EVENT(session, JOURNAL_START, room);
+
+    // Start the journey. As long as the user has not reached the END ROOM,
+    // or as long as (s)he has not explored for too long without finding it
+    // (controlled by MAX_PATH), keep presenting rooms.
+    //
+    while((currRoom->type != END_ROOM) && (path.pathCount < MAX_PATH)) {
+
+        // Display the current Room name.
+        //
+        printf("CURRENT LOCATION: %s\n",
+               roomName(world, currRoom - world->rooms));
+
+        //
+        // Display the adjacent ("CONNECTION") Rooms. Only the current
+        // Room's own slice of adjList[] is walked, so this costs the
+        // number of connections rather than the number of Rooms. The
+        // first connection will not be preceded by a comma. A lazily
+        // loaded World's prefetcher may be growing adjList[] meanwhile,
+        // so the pointer is read atomically (see loadRoom()).
+        //
+        
+        adj = __atomic_load_n(&world->adjList, __ATOMIC_ACQUIRE) +
+              currRoom->adjStart;
+        printf("POSSIBLE CONNECTIONS:");
+        for(x = 0; x < currRoom->adjCount; x++) {
+            printf("%s %s", (x == 0 ? "" : ","), roomName(world, adj[x]));
+        }
+
+        // Append a period to close out the adjacent room list, then
+        // prompt the user for an adjacent Room to visit. If the Rooms
+        // are being loaded lazily, the neighbours are read in the
+        // background while the user types.
+        //
+        printf(".\nWHERE TO? >");
+        prefetchRooms(world, currRoom - world->rooms);
+
+        // Read the user's Room input. If there is no more input, there
+        // is no way to keep playing. SIGTERM saves the game and stops.
+        //
+        if(checkpointStop == 0 &&
+           fgets(userInput, MAX_INPUT_CHARS, stdin) == NULL &&
+           checkpointStop == 0) {
+            printf("\n");
+            JOURNAL_EVENT(session, JOURNAL_QUIT, currRoom - world->rooms);
+            return 1;
+        }
+        if(checkpointStop) {
+            JOURNAL_EVENT(session, JOURNAL_QUIT, currRoom - world->rooms);
+            if(saveCheckpoint(saveName, worldId, startRoom,
+                              currRoom - world->rooms, &path) != 0) {
+                return 1;
+            }
+            printf("\nGAME SAVED.\n");
+            return 0;
+        }
+
+        // Remove trailing newline by replacing it with a null terminator.
+        //
+        userInputLen = strlen(userInput) - 1; 
+        if(userInputLen >= 0 && userInput[userInputLen] == '\n') {
+            userInput[userInputLen] = '\0';
+        }
+
+        // Did the user enter a valid adjacent Room name? If the Room
+        // entered is adjacent to the current Room, make the new Room the
+        // current Room, add the Room's index to the path, and increment
+        // the path counter. Otherwise, start over prompting the user for
+        // an adjacent room using the existing current Room's data (don't
+        // change any path values. Wrong answers do not count as part of
+        // the journey). HINT is not a Room, so it names the adjacent
+        // Room on a shortest path to the END ROOM instead. Asking for a
+        // hint does not count as a step either.
+        //
+        // SAVE writes a checkpoint (with --checkpoint) and is not a step
+        // either.
+        //
+        userInputIdx = moveRoom(world, currRoom - world->rooms, userInput);
+
+        if(userInputIdx < 0 && saveName != NULL &&
+           strcmp(userInput, "SAVE") == 0) {
+            if(saveCheckpoint(saveName, worldId, startRoom,
+                              currRoom - world->rooms, &path) == 0) {
+                printf("\nGAME SAVED.\n");
+            }
+        } else if(userInputIdx >= 0) {
+            JOURNAL_EVENT(session, JOURNAL_MOVE, userInputIdx);
+            loadRoom(world, userInputIdx);
+            currRoom = &world->rooms[userInputIdx];
+            path.pathIdxs[path.pathCount] = userInputIdx;
+            path.pathCount++;
+        } else if(strcmp(userInput, "HINT") == 0) {
+            hint = bestMove(world, currRoom - world->rooms);
+            JOURNAL_EVENT(session, JOURNAL_HINT, hint);
+            if(hint >= 0 && world->rooms[hint].endDist == 0) {
+                printf("\nHINT: TRY %s. IT IS THE END ROOM.\n",
+                       roomName(world, hint));
+            } else if(hint >= 0) {
+                printf("\nHINT: TRY %s. THE END ROOM IS %d STEP%s FROM "
+                       "THERE.\n", roomName(world, hint),
+                       world->rooms[hint].endDist,
+                       (world->rooms[hint].endDist == 1 ? "" : "S"));
+            } else {
+                printf("\nSORRY, NO HINT HERE.\n");
+            }
+        } else {
+            JOURNAL_EVENT(session, JOURNAL_REJECT, -1);
+            printf("\nHUH? I DON'T UNDERSTAND THAT ROOM. TRY AGAIN.\n");
+        }
+
+        // Pretty things up with a newline.
+        //
+        printf("\n");
+    }
+
+    // At this point, the user has either found the END ROOM or has run
+    // out of allowed steps. Figure out which and report accordingly. Note
+    // that if the path only contains one Room, report the steps as "STEP"
+    // (singular) and not "STEPS" (plural).
+    //
+    JOURNAL_EVENT(session, (currRoom->type == END_ROOM ? JOURNAL_WIN :
+                            JOURNAL_LOSE), currRoom - world->rooms);
+    if(currRoom->type == END_ROOM) {
+        printf("YOU HAVE FOUND THE END ROOM. CONGRATULATIONS!\n");
+        printf("YOU TOOK %d STEP%s YOUR PATH TO VICTORY WAS:\n", path.pathCount, (path.pathCount > 1 ? "S." : "."));
+
+        // Print out the path that lead to the END ROOM.
+        //
+        for(i = 0; i < path.pathCount; i++) {
+            printf("%s\n", roomName(world, path.pathIdxs[i]));
+        }
+
+        // Score the path against the shortest one, if it is known.
+        //
+        if(world->rooms[startRoom].endDist > 0) {
+            printf("THE SHORTEST PATH WAS %d STEP%s\n",
+                   world->rooms[startRoom].endDist,
+                   (world->rooms[startRoom].endDist > 1 ? "S." : "."));
+        }
+    } else {
+        // The user ran out of allowed steps. Don't bother showing the
+        // path. They lost (and it's not required, I believe).
+        //
+        printf("YOU DIDN'T FIND THE END ROOM IN %d MOVES! SO SORRY.\n", MAX_PATH);
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// playBatch(struct World *world, char fileName[])
+//
+// Purpose: Replay scripted sessions with no prompts.
+//
+// *****************************************************************************
+//
+int playBatch(struct World *world, char fileName[]) {
+
+    int i;               // loop iterator
+    int startRoom;       // where every session begins
+    int currRoom;        // Room the session is in
+    int nextRoom;        // Room a move leads to, or -1
+    int rejected;        // moves in the session that were not allowed
+
+    long sessions = 0;   // sessions replayed
+    long moves = 0;      // moves read, allowed or not
+
+    uint32_t session;    // the session's number in the journal
+    long wins = 0;       // sessions that found the END ROOM
+    long losses = 0;     // sessions that ran out of steps
+
+    double seconds;      // time taken to replay everything
+
+    FILE *fp = NULL;     // scripted sessions
+
+    char *line = NULL;   // one session, read by getline()
+    size_t lineSize = 0; // bytes allocated for line by getline()
+    char *move;          // one Room name from the line
+    char *savePtr;       // strtok_r() position in the line
+
+    struct Path path;    // Rooms visited in the session
+
+    if(strcmp(fileName, "-") == 0) {
+        fp = stdin;
+    } else {
+        fp = fopen(fileName, "r");
+        if(fp == NULL) {
+            printf("Error opening %s: errno = %d\n", fileName, errno);
+            return 1;
+        }
+        STAT_ADD(filesOpened, 1);
+    }
+
+    startRoom = findStartRoom(world);
+    if(startRoom < 0) {
+        printf("There is no START_ROOM. Nowhere to begin.\n");
+        return 1;
+    }
+    loadRoom(world, startRoom);
+
+    seconds = nowSeconds();
+
+    // Each line is a session. Start it in the START_ROOM and apply the
+    // moves in order until the END ROOM is found or MAX_PATH steps have
+    // been taken. Like in playGame(), a move that is not allowed is
+    // skipped and does not count as a step. Anything left on the line
+    // after the session is over is ignored.
+    //
+    while(getline(&line, &lineSize, fp) != -1) {
+        STAT_ADD(bytesRead, strlen(line));
+        currRoom = startRoom;
+        path.pathCount = 0;
+        rejected = 0;
+        session = journalSession();
+        JOURNAL_EVENT(session, JOURNAL_START, startRoom);
+
+        move = strtok_r(line, " \t,\r\n", &savePtr);
+        while(move != NULL && world->rooms[currRoom].type != END_ROOM &&
+              path.pathCount < MAX_PATH) {
+            moves++;
+            nextRoom = moveRoom(world, currRoom, move);
+            if(nextRoom >= 0) {
+                JOURNAL_EVENT(session, JOURNAL_MOVE, nextRoom);
+                loadRoom(world, nextRoom);
+                currRoom = nextRoom;
+                path.pathIdxs[path.pathCount++] = nextRoom;
+            } else {
+                JOURNAL_EVENT(session, JOURNAL_REJECT, -1);
+                rejected++;
+            }
+            move = strtok_r(NULL, " \t,\r\n", &savePtr);
+        }
+
+        // Report the session: its number, how it ended (WIN, LOSE when
+        // out of steps, QUIT when out of moves), the steps taken, the
+        // moves rejected and the path.
+        //
+        sessions++;
+        if(world->rooms[currRoom].type == END_ROOM) {
+            wins++;
+            JOURNAL_EVENT(session, JOURNAL_WIN, currRoom);
+            printf("%ld WIN", sessions);
+        } else if(path.pathCount >= MAX_PATH) {
+            losses++;
+            JOURNAL_EVENT(session, JOURNAL_LOSE, currRoom);
+            printf("%ld LOSE", sessions);
+        } else {
+            JOURNAL_EVENT(session, JOURNAL_QUIT, currRoom);
+            printf("%ld QUIT", sessions);
+        }
+        printf(" %d %d", path.pathCount, rejected);
+        for(i = 0; i < path.pathCount; i++) {
+            printf(" %s", roomName(world, path.pathIdxs[i]));
+        }
+        printf("\n");
+    }
+
+    seconds = nowSeconds() - seconds;
+
+    free(line);
+    if(fp != stdin) {
+        fclose(fp);
+    }
+
+    // Make sure every result is out before the summary goes to stderr.
+    //
+    fflush(stdout);
+    fprintf(stderr, "BATCH: %ld sessions (%ld won, %ld lost, %ld quit), "
+            "%ld moves in %.3f s: %.0f sessions/s, %.0f moves/s\n",
+            sessions, wins, losses, sessions - wins - losses, moves, seconds,
+            (seconds > 0 ? sessions / seconds : 0.0),
+            (seconds > 0 ? moves / seconds : 0.0));
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+//
+// jsonString(char **buf, size_t *len, size_t *size, const char *text)
+//
+// Purpose: Append text to a growable buffer as a quoted JSON string.
+//          Room names come from files, so quotes, backslashes and
+//          control characters are escaped.
+//
+// *****************************************************************************
+//
+static void jsonString(char **buf, size_t *len, size_t *size,
+                       const char *text) {
+
+    size_t n = strlen(text);     // length of the text
+
+    // Escaping at most makes each character 6 long (\u00XX).
+    //
+    bufReserve(buf, len, size, n * 6 + 3);
+    (*buf)[(*len)++] = '"';
+    for(; *text != '\0'; text++) {
+        if(*text == '"' || *text == '\\') {
+            (*buf)[(*len)++] = '\\';
+            (*buf)[(*len)++] = *text;
+        } else if((unsigned char) *text < 0x20) {
+            *len += snprintf(*buf + *len, 7, "\\u%04x",
+                             (unsigned char) *text);
+        } else {
+            (*buf)[(*len)++] = *text;
+        }
+    }
+    (*buf)[(*len)++] = '"';
+    (*buf)[*len] = '\0';
+
+}
+
+
+// *****************************************************************************
+//
+// jsonTurn(struct World *world, int startRoom, int currRoom,
+//          struct Path *path, const char *error, int hint, char **buf,
+//          size_t *len, size_t *size)
+//
+// Purpose: Append the machine protocol's answer for one turn to a
+//          growable buffer: one line holding one JSON object. Returns 1
+//          if the game is over, 0 if it goes on. The object has
+//
+//             status       "playing", "won" or "lost"
+//             room, name   the Room the player is in
+//             steps        steps taken so far
+//             error        "bad move" if the last move was not allowed
+//             hint         answer to HINT: a Room index, or -1 if
+//                          there is none (only after a HINT)
+//             connections, names
+//                          adjacent Room indices and names, in the same
+//                          order (while playing)
+//             path         Room indices visited (once the game is over)
+//             shortest     steps on a shortest path (once won, if known)
+//
+// *****************************************************************************
+//
+static int jsonTurn(struct World *world, int startRoom, int currRoom,
+                    struct Path *path, const char *error, int hint,
+                    char **buf, size_t *len, size_t *size) {
+
+    int x;               // loop iterator
+    int over;            // 1 once the game is won or lost
+
+    int32_t *adj;        // the Room's slice of adjList[]
+
+    struct Room *room = &world->rooms[currRoom];
+
+    over = (room->type == END_ROOM || path->pathCount >= MAX_PATH);
+
+    bufPrintf(buf, len, size, "{\"status\":\"%s\",\"room\":%d,\"name\":",
+              (room->type == END_ROOM ? "won" : over ? "lost" : "playing"),
+              currRoom);
+    jsonString(buf, len, size, roomName(world, currRoom));
+    bufPrintf(buf, len, size, ",\"steps\":%d", path->pathCount);
+    if(error != NULL) {
+        bufPrintf(buf, len, size, ",\"error\":\"%s\"", error);
+    }
+    if(hint != HINT_NOT_ASKED) {
+        bufPrintf(buf, len, size, ",\"hint\":%d", hint);
+    }
+
+    if(over == 0) {
+        adj = __atomic_load_n(&world->adjList, __ATOMIC_ACQUIRE) +
+              room->adjStart;
+        bufPrintf(buf, len, size, ",\"connections\":[");
+        for(x = 0; x < room->adjCount; x++) {
+            bufPrintf(buf, len, size, "%s%d", (x == 0 ? "" : ","), adj[x]);
+        }
+        bufPrintf(buf, len, size, "],\"names\":[");
+        for(x = 0; x < room->adjCount; x++) {
+            if(x > 0) {
+                bufPrintf(buf, len, size, ",");
+            }
+            jsonString(buf, len, size, roomName(world, adj[x]));
+        }
+        bufPrintf(buf, len, size, "]");
+    } else {
+        bufPrintf(buf, len, size, ",\"path\":[");
+        for(x = 0; x < path->pathCount; x++) {
+            bufPrintf(buf, len, size, "%s%d", (x == 0 ? "" : ","),
+                      path->pathIdxs[x]);
+        }
+        bufPrintf(buf, len, size, "]");
+        if(room->type == END_ROOM && world->rooms[startRoom].endDist >= 0) {
+            bufPrintf(buf, len, size, ",\"shortest\":%d",
+                      world->rooms[startRoom].endDist);
+        }
+    }
+    bufPrintf(buf, len, size, "}\n");
+
+    return over;
+
+}
+
+
+// *****************************************************************************
+//
+// readMove(struct World *world, int currRoom, char line[], int *hint)
+//
+// Purpose: Play one line of machine protocol input: a Room index (all
+//          digits), HINT, or a Room name. Returns the Room moved to, or
+//          -1. *hint is set to bestMove() after a HINT, and to
+//          HINT_NOT_ASKED otherwise.
+//
+// *****************************************************************************
+//
+static int readMove(struct World *world, int currRoom, char line[],
+                    int *hint) {
+
+    long room;           // Room index on the line
+    char *end;           // first character strtol() did not convert
+
+    *hint = HINT_NOT_ASKED;
+    if(line[0] >= '0' && line[0] <= '9') {
+        room = strtol(line, &end, 10);
+        if(*end != '\0' || room >= world->numRooms) {
+            room = -1;
+        }
+        return moveRoomIndex(world, currRoom, (int) room);
+    }
+    if(strcmp(line, "HINT") == 0) {
+        *hint = bestMove(world, currRoom);
+        return -1;
+    }
+
+    return moveRoom(world, currRoom, line);
+
+}
+
+
+// *****************************************************************************
+// 
+// playProtocol(struct World *world, char saveName[], char resumeName[])
+//
+// Purpose: Play one game with a program over stdin and stdout.
+//
+// *****************************************************************************
+//
+int playProtocol(struct World *world, char saveName[], char resumeName[]) {
+
+    int startRoom;       // where the game begins
+    int currRoom;        // Room the player is in
+    int room;            // Room a move leads to, or -1
+    int hint = HINT_NOT_ASKED; // answer to HINT, for jsonTurn()
+    int over;            // 1 once the game is won or lost
+    int lineLen;         // length of the input line
+    int saved = 0;       // 1 once SAVE has written a checkpoint
+
+    uint64_t worldId = 0; // worldChecksum(), for checkpoints
+    uint32_t session;    // the game's number in the journal
+
+    const char *error = NULL; // what was wrong with the last move
+
+    char line[MAX_INPUT_CHARS]; // one line of input
+
+    char *out = NULL;    // the answer for one turn
+    size_t outLen = 0;   // bytes used in out[]
+    size_t outSize = 0;  // bytes allocated for out[]
+    ssize_t sent;        // bytes taken by the last write()
+    size_t outSent;      // bytes of out[] written so far
+
+    struct Path path;    // Rooms visited so far
+
+    startRoom = findStartRoom(world);
+    if(startRoom < 0) {
+        printf("There is no START_ROOM. Nowhere to begin.\n");
+        return 1;
+    }
+    currRoom = startRoom;
+    path.pathCount = 0;
+    startCheckpoints(world, saveName, resumeName, startRoom, &worldId,
+                     &currRoom, &path);
+    loadRoom(world, currRoom);
+    session = journalSession();
+    JOURNAL_EVENT(session, JOURNAL_START, currRoom);
+
+    // Nothing else may be waiting in stdout's buffer once the turns are
+    // written to its file descriptor directly.
+    //
+    fflush(stdout);
+
+    for(;;) {
+        // Build the whole answer, then hand it over in one write().
+        //
+        outLen = 0;
+        over = jsonTurn(world, startRoom, currRoom, &path, error, hint,
+                        &out, &outLen, &outSize);
+        if(saved) {
+            outLen -= 2;
+            bufPrintf(&out, &outLen, &outSize, ",\"saved\":true}\n");
+            saved = 0;
+        }
+        for(outSent = 0; outSent < outLen; outSent += sent) {
+            sent = write(STDOUT_FILENO, out + outSent, outLen - outSent);
+            if(sent < 0 && errno == EINTR) {
+                sent = 0;
+            } else if(sent < 0) {
+                free(out);
+                return 1;
+            }
+        }
+        if(over) {
+            JOURNAL_EVENT(session, (world->rooms[currRoom].type == END_ROOM ?
+                                    JOURNAL_WIN : JOURNAL_LOSE), currRoom);
+            break;
+        }
+
+        // Same rules as playGame(): a wrong answer or a HINT does not
+        // count as a step.
+        //
+        prefetchRooms(world, currRoom);
+        if(checkpointStop == 0 &&
+           fgets(line, MAX_INPUT_CHARS, stdin) == NULL &&
+           checkpointStop == 0) {
+            JOURNAL_EVENT(session, JOURNAL_QUIT, currRoom);
+            break;
+        }
+        if(checkpointStop) {
+            JOURNAL_EVENT(session, JOURNAL_QUIT, currRoom);
+            free(out);
+            return saveCheckpoint(saveName, worldId, startRoom, currRoom,
+                                  &path);
+        }
+        lineLen = strlen(line);
+        while(lineLen > 0 && (line[lineLen - 1] == '\n' ||
+                              line[lineLen - 1] == '\r')) {
+            line[--lineLen] = '\0';
+        }
+
+        // SAVE is answered with the same turn again, marked "saved".
+        //
+        error = NULL;
+        hint = HINT_NOT_ASKED;
+        room = -1;
+        if(saveName != NULL && strcmp(line, "SAVE") == 0) {
+            saved = (saveCheckpoint(saveName, worldId, startRoom, currRoom,
+                                    &path) == 0);
+            if(saved == 0) {
+                error = "save failed";
+            }
+            continue;
+        }
+        room = readMove(world, currRoom, line, &hint);
+        if(room >= 0) {
+            JOURNAL_EVENT(session, JOURNAL_MOVE, room);
+            loadRoom(world, room);
+            currRoom = room;
+            path.pathIdxs[path.pathCount++] = room;
+        } else if(hint == HINT_NOT_ASKED) {
+            JOURNAL_EVENT(session, JOURNAL_REJECT, -1);
+            error = "bad move";
+        } else {
+            JOURNAL_EVENT(session, JOURNAL_HINT, hint);
+        }
+    }
+
+    free(out);
+
+    return 0;
+
+}
+
+
+// struct Session: One player connected to serveGames(). The game itself
+// only needs currRoom and path; the rest is buffering for the socket.
+//
+// fd         -> The player's connection.
+//
+// id         -> The game's number in the journal.
+//
+// startRoom  -> Index of the START ROOM, for scoring the game.
+//
+// currRoom   -> Index of the Room the player is in.
+//
+// path       -> Rooms visited so far, as in playGame().
+//
+// in[], inLen
+//            -> Bytes received that do not make a whole line yet.
+//
+// out[], outLen, outSent
+//            -> Text waiting to be sent; outSent bytes of it already
+//               went out.
+//
+// done       -> 1 once the game is over. The connection is closed as
+//               soon as out[] has been sent.
+//
+// protocol   -> How the game talks to the player (see serveGames()).
+//
+struct Session {
+    int fd;
+    uint32_t id;
+    int startRoom;
+    int currRoom;
+    struct Path path;
+    char in[MAX_INPUT_CHARS];
+    int inLen;
+    char *out;
+    size_t outLen;
+    size_t outSize;
+    size_t outSent;
+    int done;
+    enum protocol protocol;
+};
+
+
+#ifdef __linux__
+
+// Set by the SIGINT and SIGTERM handler to stop serveGames().
+//
+static volatile sig_atomic_t serveStop = 0;
+
+
+// *****************************************************************************
+//
+// serveSignal(int sig)
+//
+// Purpose: Ask serveGames() to stop.
+//
+// *****************************************************************************
+//
+static void serveSignal(int sig) {
+
+    (void) sig;
+    serveStop = 1;
+
+}
+
+
+// *****************************************************************************
+//
+// sessionPrintf(struct Session *session, const char *format, ...)
+//
+// Purpose: Queue text for a player, like printf() does for playGame().
+//
+// *****************************************************************************
+//
+static void sessionPrintf(struct Session *session, const char *format, ...) {
+
+    va_list args;        // the values to print
+    int len;             // length of the formatted text
+
+    va_start(args, format);
+    len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    bufReserve(&session->out, &session->outLen, &session->outSize, len + 1);
+
+    va_start(args, format);
+    vsnprintf(session->out + session->outLen, len + 1, format, args);
+    va_end(args);
+    session->outLen += len;
+
+}
+
+
+// *****************************************************************************
+//
+// sessionPrompt(struct World *world, struct Session *session,
+//               const char *error, int hint)
+//
+// Purpose: Queue what playGame() shows at the start of each turn, or the
+//          result once the game is over. A JSON_PROTOCOL player gets
+//          jsonTurn() instead, which also carries the error and hint
+//          (in text they are shown by sessionInput()).
+//
+// *****************************************************************************
+//
+static void sessionPrompt(struct World *world, struct Session *session,
+                          const char *error, int hint) {
+
+    int i, x;            // loop iterators
+
+    int32_t *adj;        // the current Room's slice of adjList[]
+
+    struct Room *currRoom = &world->rooms[session->currRoom];
+
+    if(session->protocol == JSON_PROTOCOL) {
+        session->done = jsonTurn(world, session->startRoom,
+                                 session->currRoom, &session->path, error,
+                                 hint, &session->out, &session->outLen,
+                                 &session->outSize);
+    } else if(currRoom->type == END_ROOM) {
+        sessionPrintf(session, "YOU HAVE FOUND THE END ROOM. "
+                      "CONGRATULATIONS!\n");
+        sessionPrintf(session, "YOU TOOK %d STEP%s YOUR PATH TO VICTORY "
+                      "WAS:\n", session->path.pathCount,
+                      (session->path.pathCount > 1 ? "S." : "."));
+        for(i = 0; i < session->path.pathCount; i++) {
+            sessionPrintf(session, "%s\n",
+                          roomName(world, session->path.pathIdxs[i]));
+        }
+        if(world->rooms[session->startRoom].endDist > 0) {
+            sessionPrintf(session, "THE SHORTEST PATH WAS %d STEP%s\n",
+                          world->rooms[session->startRoom].endDist,
+                          (world->rooms[session->startRoom].endDist > 1 ?
+                           "S." : "."));
+        }
+        session->done = 1;
+    } else if(session->path.pathCount >= MAX_PATH) {
+        sessionPrintf(session, "YOU DIDN'T FIND THE END ROOM IN %d MOVES! "
+                      "SO SORRY.\n", MAX_PATH);
+        session->done = 1;
+    } else {
+        sessionPrintf(session, "CURRENT LOCATION: %s\n",
+                      roomName(world, session->currRoom));
+        adj = __atomic_load_n(&world->adjList, __ATOMIC_ACQUIRE) +
+              currRoom->adjStart;
+        sessionPrintf(session, "POSSIBLE CONNECTIONS:");
+        for(x = 0; x < currRoom->adjCount; x++) {
+            sessionPrintf(session, "%s %s", (x == 0 ? "" : ","),
+                          roomName(world, adj[x]));
+        }
+        sessionPrintf(session, ".\nWHERE TO? >");
+    }
+
+}
+
+
+// *****************************************************************************
+//
+// sessionFlush(struct Session *session)
+//
+// Purpose: Send as much queued text as the socket takes without
+//          blocking. Returns 1 if some is still waiting, 0 if it all
+//          went out, -1 if the player is gone.
+//
+// *****************************************************************************
+//
+static int sessionFlush(struct Session *session) {
+
+    ssize_t sent;        // bytes taken by the last send()
+
+    while(session->outSent < session->outLen) {
+        sent = send(session->fd, session->out + session->outSent,
+                    session->outLen - session->outSent, MSG_NOSIGNAL);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1);
+        }
+        session->outSent += sent;
+        STAT_ADD(bytesWritten, sent);
+    }
+    session->outLen = 0;
+    session->outSent = 0;
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+//
+// sessionInput(struct World *world, struct Session *session)
+//
+// Purpose: Read what a player sent and play every whole line as a move.
+//          Returns 0 normally, -1 if the player is gone.
+//
+// *****************************************************************************
+//
+static int sessionInput(struct World *world, struct Session *session) {
+
+    int i;               // loop iterator
+    int start;           // where the line being played starts in in[]
+    int room;            // Room a move leads to, or -1
+    int hint;            // Room suggested by the HINT command
+    ssize_t got;         // bytes returned by the last read()
+
+    for(;;) {
+        got = read(session->fd, session->in + session->inLen,
+                   MAX_INPUT_CHARS - 1 - session->inLen);
+        if(got < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1);
+        }
+        if(got == 0) {
+            return -1;
+        }
+        STAT_ADD(bytesRead, got);
+        session->inLen += got;
+
+        // Play each whole line. A line too long for in[] is played as it
+        // is, which can only be a wrong answer.
+        //
+        start = 0;
+        for(i = 0; i < session->inLen && session->done == 0; i++) {
+            if(session->in[i] != '\n' && i < MAX_INPUT_CHARS - 2) {
+                continue;
+            }
+            session->in[i] = '\0';
+            if(i > start && session->in[i - 1] == '\r') {
+                session->in[i - 1] = '\0';
+            }
+
+            // Same rules as playGame(): a wrong answer or a HINT does not
+            // count as a step.
+            //
+            if(session->protocol == JSON_PROTOCOL) {
+                room = readMove(world, session->currRoom,
+                                session->in + start, &hint);
+                JOURNAL_EVENT(session->id, (room >= 0 ? JOURNAL_MOVE :
+                                            hint == HINT_NOT_ASKED ?
+                                            JOURNAL_REJECT : JOURNAL_HINT),
+                              (room >= 0 ? room : hint == HINT_NOT_ASKED ?
+                               -1 : hint));
+                if(room >= 0) {
+                    loadRoom(world, room);
+                    session->currRoom = room;
+                    session->path.pathIdxs[session->path.pathCount++] = room;
+                }
+                sessionPrompt(world, session,
+                              (room < 0 && hint == HINT_NOT_ASKED ?
+                               "bad move" : NULL), hint);
+                start = i + 1;
+                continue;
+            }
+
+            room = moveRoom(world, session->currRoom, session->in + start);
+            if(room >= 0) {
+                JOURNAL_EVENT(session->id, JOURNAL_MOVE, room);
+                loadRoom(world, room);
+                session->currRoom = room;
+                session->path.pathIdxs[session->path.pathCount++] = room;
+                sessionPrintf(session, "\n");
+            } else if(strcmp(session->in + start, "HINT") == 0) {
+                hint = bestMove(world, session->currRoom);
+                JOURNAL_EVENT(session->id, JOURNAL_HINT, hint);
+                if(hint >= 0 && world->rooms[hint].endDist == 0) {
+                    sessionPrintf(session, "\nHINT: TRY %s. IT IS THE END "
+                                  "ROOM.\n\n", roomName(world, hint));
+                } else if(hint >= 0) {
+                    sessionPrintf(session, "\nHINT: TRY %s. THE END ROOM IS "
+                                  "%d STEP%s FROM THERE.\n\n",
+                                  roomName(world, hint),
+                                  world->rooms[hint].endDist,
+                                  (world->rooms[hint].endDist == 1 ?
+                                   "" : "S"));
+                } else {
+                    sessionPrintf(session, "\nSORRY, NO HINT HERE.\n\n");
+                }
+            } else {
+                JOURNAL_EVENT(session->id, JOURNAL_REJECT, -1);
+                sessionPrintf(session, "\nHUH? I DON'T UNDERSTAND THAT "
+                              "ROOM. TRY AGAIN.\n\n");
+            }
+            sessionPrompt(world, session, NULL, HINT_NOT_ASKED);
+            start = i + 1;
+        }
+
+        // Keep the start of an unfinished line for next time.
+        //
+        if(session->done) {
+            session->inLen = 0;
+        } else {
+            memmove(session->in, session->in + start, session->inLen - start);
+            session->inLen -= start;
+        }
+    }
+
+}
+
+
+// *****************************************************************************
+//
+// serveGames(struct World *world, char sockName[], enum protocol protocol)
+//
+// Purpose: Play many games at once over a Unix domain socket.
+//
+// *****************************************************************************
+//
+int serveGames(struct World *world, char sockName[], enum protocol protocol) {
+
+    int i;               // loop iterator
+    int listenFd;        // the listening socket
+    int epollFd;         // the epoll instance watching every socket
+    int numEvents;       // events returned by epoll_wait()
+    int fd;              // a newly accepted connection
+    int startRoom;       // where every game begins
+    int pending;         // result of sessionFlush()
+
+    long sessions = 0;   // games started
+    long active = 0;     // games still connected
+    long peak = 0;       // most games connected at once
+
+    struct sockaddr_un addr;     // where to listen
+    struct epoll_event event;    // one socket to watch
+    struct epoll_event events[SERVE_EVENTS]; // sockets that are ready
+    struct sigaction action;     // how SIGINT and SIGTERM are handled
+
+    struct Session *session;     // the player an event is for
+
+    startRoom = findStartRoom(world);
+    if(startRoom < 0) {
+        printf("There is no START_ROOM. Nowhere to begin.\n");
+        return 1;
+    }
+    loadRoom(world, startRoom);
+
+    // Listen on the socket, replacing one left behind by an earlier run.
+    //
+    if(strlen(sockName) >= sizeof(addr.sun_path)) {
+        printf("Error: socket path %s is too long\n", sockName);
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sockName);
+    unlink(sockName);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listenFd < 0 || bind(listenFd, (struct sockaddr *) &addr,
+                            sizeof(addr)) != 0 ||
+       listen(listenFd, SOMAXCONN) != 0) {
+        printf("Error listening on %s: errno = %d\n", sockName, errno);
+        return 1;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(epollFd < 0) {
+        printf("Error creating epoll instance: errno = %d\n", errno);
+        return 1;
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;         // NULL marks the listening socket
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+
+    // Stop cleanly on SIGINT or SIGTERM. Without SA_RESTART the signal
+    // breaks epoll_wait() out with EINTR.
+    //
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = serveSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    fprintf(stderr, "SERVE: listening on %s\n", sockName);
+
+    while(serveStop == 0) {
+        numEvents = epoll_wait(epollFd, events, SERVE_EVENTS, -1);
+        if(numEvents < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            printf("Error waiting for events: errno = %d\n", errno);
+            break;
+        }
+
+        for(i = 0; i < numEvents; i++) {
+            session = (struct Session *) events[i].data.ptr;
+
+            // A new player: start them in the START_ROOM and show it.
+            //
+            if(session == NULL) {
+                while((fd = accept(listenFd, NULL, NULL)) >= 0) {
+                    session = (struct Session *) calloc(1,
+                                                        sizeof(struct Session));
+                    if(session == NULL ||
+                       fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+                        free(session);
+                        close(fd);
+                        continue;
+                    }
+                    session->fd = fd;
+                    session->id = journalSession();
+                    session->protocol = protocol;
+                    session->startRoom = startRoom;
+                    session->currRoom = startRoom;
+                    JOURNAL_EVENT(session->id, JOURNAL_START, startRoom);
+                    sessionPrompt(world, session, NULL, HINT_NOT_ASKED);
+                    pending = sessionFlush(session);
+
+                    event.events = EPOLLIN | (pending > 0 ? EPOLLOUT : 0);
+                    event.data.ptr = session;
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+
+                    sessions++;
+                    active++;
+                    if(active > peak) {
+                        peak = active;
+                    }
+                }
+                continue;
+            }
+
+            // A player sent moves, has room for more output, or left.
+            //
+            pending = 0;
+            if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+                pending = -1;
+            }
+            if(pending == 0 && (events[i].events & EPOLLIN) &&
+               sessionInput(world, session) < 0) {
+                pending = -1;
+            }
+            if(pending == 0) {
+                pending = sessionFlush(session);
+            }
+
+            // Close the connection once the game is over and everything
+            // has been sent, or as soon as the player is gone. A player
+            // who leaves before the game is over has quit.
+            //
+            if(pending < 0 || (pending == 0 && session->done)) {
+                JOURNAL_EVENT(session->id,
+                              (session->done == 0 ? JOURNAL_QUIT :
+                               world->rooms[session->currRoom].type ==
+                               END_ROOM ? JOURNAL_WIN : JOURNAL_LOSE),
+                              session->currRoom);
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, session->fd, NULL);
+                close(session->fd);
+                free(session->out);
+                free(session);
+                active--;
+            } else {
+                event.events = (session->done ? 0 : EPOLLIN) |
+                               (pending > 0 ? EPOLLOUT : 0);
+                event.data.ptr = session;
+                epoll_ctl(epollFd, EPOLL_CTL_MOD, session->fd, &event);
+            }
+        }
+    }
+
+    // Players still connected when the server stops are just dropped;
+    // the process is about to exit.
+    //
+    close(epollFd);
+    close(listenFd);
+    unlink(sockName);
+
+    fprintf(stderr, "SERVE: %ld sessions, %ld at most at once\n", sessions,
+            peak);
+
+    return 0;
+
+}
+
+#else
+
+// *****************************************************************************
+//
+// serveGames(struct World *world, char sockName[], enum protocol protocol)
+//
+// Purpose: Play many games at once over a Unix domain socket. It needs
+//          epoll, so it is only there on Linux.
+//
+// *****************************************************************************
+//
+int serveGames(struct World *world, char sockName[], enum protocol protocol) {
+
+    (void) world;
+    (void) sockName;
+    (void) protocol;
+    printf("Error: --serve is only supported on Linux\n");
+
+    return 1;
+
+}
+
+#endif
+
+
+// *****************************************************************************
+// 
+// runBenchmark(struct GenParams *params, char *roomNames[],
+//              char roomList[], char degreeList[], int json)
+//
+// Purpose: Time each phase of the game for a sweep of Worlds.
+//
+// *****************************************************************************
+//
+int runBenchmark(struct GenParams *params, char *roomNames[],
+                 char roomList[], char degreeList[], int json) {
+
+    int i;               // loop iterator
+    int rows = 0;        // result rows printed so far
+    int result = 0;      // 1 once something has gone wrong
+    int numRooms;        // room count being benchmarked
+    int minDegree, maxDegree; // degree bounds being benchmarked
+    int currRoom;        // Room the benchmark player is in
+    int nextRoom;        // Room picked to move to
+    int numAdj;          // connections in the generated World
+
+    enum worldFormat format; // storage format being benchmarked
+
+    char *rooms, *degrees;      // writable copies of the lists
+    char *roomTok, *degreeTok;  // one entry of each list
+    char *roomSave, *degreeSave; // strtok_r() positions in the lists
+
+    char worldName[MAX_PATH_CHARS]; // where the World is written
+
+    double start;        // when the phase being timed began
+    double genTime, writeTime, loadTime, moveTime; // phase timings
+
+    struct World world = {0}; // World being benchmarked
+    struct Rng rng;      // picks the benchmark player's moves
+
+    if(json) {
+        printf("[");
+    } else {
+        printf("rooms,min_degree,max_degree,format,seed,connections,"
+               "generate_s,write_s,load_s,moves,move_s,moves_per_s\n");
+    }
+
+    // Every loop below stops as soon as result is set, so the lists
+    // are freed however the sweep ends.
+    //
+    rooms = strdup(roomList);
+    for(roomTok = strtok_r(rooms, ",", &roomSave);
+        roomTok != NULL && result == 0;
+        roomTok = strtok_r(NULL, ",", &roomSave)) {
+
+        numRooms = (int) strtol(roomTok, NULL, 10);
+        if(numRooms < MIN_ROOMS) {
+            fprintf(stderr, "Invalid room count: %s\n", roomTok);
+            result = 1;
+            break;
+        }
+
+        degrees = strdup(degreeList);
+        for(degreeTok = strtok_r(degrees, ",", &degreeSave);
+            degreeTok != NULL && result == 0;
+            degreeTok = strtok_r(NULL, ",", &degreeSave)) {
+
+            if(sscanf(degreeTok, "%d-%d", &minDegree, &maxDegree) != 2 ||
+               minDegree < 1 || maxDegree < 2 || minDegree > maxDegree ||
+               maxDegree > MAX_DEGREE_LIMIT) {
+                fprintf(stderr, "Invalid degree bounds: %s\n", degreeTok);
+                result = 1;
+                break;
+            }
+
+            params->numRooms = numRooms;
+            params->minDegree = minDegree;
+            params->maxDegree = maxDegree;
+
+            for(format = TEXT_FORMAT; format <= BINARY_FORMAT && result == 0;
+                format++) {
+
+                // Generation: build the World in memory.
+                //
+                start = nowSeconds();
+                generateRooms(&world, params, roomNames);
+                genTime = nowSeconds() - start;
+                numAdj = world.numAdj;
+
+                // File write: put it on disk in this format. Timing the
+                // load of a World that never made it to disk would only
+                // give meaningless numbers, so a failed write ends the
+                // benchmark. The write has said why and cleaned up after
+                // itself, and anything already at worldName is not ours.
+                //
+                start = nowSeconds();
+                if(format == TEXT_FORMAT) {
+                    snprintf(worldName, MAX_PATH_CHARS, "%s.%ld",
+                             "ratclier.bench", (long) getpid());
+                    result = writeRooms(&world, worldName, params->numThreads,
+                                        params->numShards);
+                } else {
+                    snprintf(worldName, MAX_PATH_CHARS, "%s.%ld.world",
+                             "ratclier.bench", (long) getpid());
+                    result = writeWorld(&world, worldName, worldKey(params));
+                }
+                writeTime = nowSeconds() - start;
+                cleanRooms(&world);
+                if(result != 0) {
+                    break;
+                }
+
+                // Load: scan the directory and parse every Room file, or
+                // map the world file.
+                //
+                start = nowSeconds();
+                if(format == TEXT_FORMAT) {
+                    result = readRooms(&world, worldName, params->numThreads);
+                } else {
+                    result = mapWorld(&world, worldName);
+                }
+                if(result != 0) {
+                    cleanRooms(&world);
+                    removeWorld(worldName);
+                    break;
+                }
+                loadTime = nowSeconds() - start;
+
+                // Move resolution: a player wanders at random, naming a
+                // random adjacent Room each turn, and every move goes
+                // through the same lookup and adjacency check as a real
+                // one.
+                //
+                rngSeed(&rng, params->seed, 0);
+                currRoom = findStartRoom(&world);
+                start = nowSeconds();
+                for(i = 0; i < BENCH_MOVES; i++) {
+                    struct Room *room = &world.rooms[currRoom];
+
+                    nextRoom = world.adjList[room->adjStart +
+                                   rngBounded(&rng, room->adjCount)];
+                    currRoom = moveRoom(&world, currRoom,
+                                        roomName(&world, nextRoom));
+                }
+                moveTime = nowSeconds() - start;
+
+                cleanRooms(&world);
+                removeWorld(worldName);
+
+                if(currRoom != nextRoom) {
+                    fprintf(stderr, "Benchmark move went astray\n");
+                    result = 1;
+                    break;
+                }
+
+                if(json) {
+                    printf("%s\n  {\"rooms\": %d, \"min_degree\": %d, "
+                           "\"max_degree\": %d, \"format\": \"%s\", "
+                           "\"seed\": %llu, \"connections\": %d, "
+                           "\"generate_s\": %.6f, \"write_s\": %.6f, "
+                           "\"load_s\": %.6f, \"moves\": %d, "
+                           "\"move_s\": %.6f, \"moves_per_s\": %.0f}",
+                           (rows == 0 ? "" : ","), numRooms, minDegree,
+                           maxDegree,
+                           (format == TEXT_FORMAT ? "text" : "binary"),
+                           (unsigned long long) params->seed, numAdj / 2,
+                           genTime, writeTime, loadTime, BENCH_MOVES,
+                           moveTime, BENCH_MOVES / moveTime);
+                } else {
+                    printf("%d,%d,%d,%s,%llu,%d,%.6f,%.6f,%.6f,%d,%.6f,%.0f\n",
+                           numRooms, minDegree, maxDegree,
+                           (format == TEXT_FORMAT ? "text" : "binary"),
+                           (unsigned long long) params->seed, numAdj / 2,
+                           genTime, writeTime, loadTime, BENCH_MOVES,
+                           moveTime, BENCH_MOVES / moveTime);
+                }
+                fflush(stdout);
+                rows++;
+            }
+        }
+        free(degrees);
+    }
+    free(rooms);
+
+    if(json && result == 0) {
+        printf("\n]\n");
+    }
+
+    return result;
+
+}
+
+
+// struct Analysis: What runAnalysis() has learned so far, per strategy
+// (see enum strategy).
+//
+// walks      -> Games simulated.
+//
+// wins       -> Games that found the END ROOM within MAX_PATH steps.
+//
+// winSteps   -> Total steps taken in the games won.
+//
+// lengths[]  -> Games won in each number of steps, 1 to MAX_PATH.
+//
+// rates[]    -> Worlds whose win rate fell in each 10% bucket; a 100%
+//               win rate gets bucket 10 to itself.
+//
+// lowRate, highRate
+//            -> Lowest and highest win rate of any one World.
+//
+struct Analysis {
+    long long walks[NUM_STRATEGIES];
+    long long wins[NUM_STRATEGIES];
+    long long winSteps[NUM_STRATEGIES];
+    long long lengths[NUM_STRATEGIES][MAX_PATH + 1];
+    int rates[NUM_STRATEGIES][11];
+    double lowRate[NUM_STRATEGIES];
+    double highRate[NUM_STRATEGIES];
+};
+
+
+// struct WalkTask: One worker thread's share of analyzeWorld(). Players
+// come in blocks of ANALYZE_BLOCK, and block b always draws from random
+// number stream ANALYZE_STREAM+b, so the results do not depend on how
+// many threads there are. Each worker plays blocks first through last-1.
+//
+struct WalkTask {
+    struct World *world;
+    uint64_t seed;
+    long long players;
+    long long first;
+    long long last;
+    int startRoom;
+    long long wins[NUM_STRATEGIES];
+    long long winSteps[NUM_STRATEGIES];
+    long long lengths[NUM_STRATEGIES][MAX_PATH + 1];
+};
+
+
+// *****************************************************************************
+//
+// freshRooms(const uint64_t *row, const uint64_t *seen, uint64_t *fresh,
+//            int words)
+//
+// Purpose: Intersect a row of adjBits[] with the Rooms not seen yet,
+//          one bitVec at a time, into fresh[]. Returns how many Rooms
+//          are in fresh[].
+//
+// *****************************************************************************
+//
+static int freshRooms(const uint64_t *row, const uint64_t *seen,
+                      uint64_t *fresh, int words) {
+
+    int w;               // loop iterator
+    int count = 0;       // Rooms in fresh[] so far
+
+    bitVec v;            // four words of fresh[]
+
+    for(w = 0; w < words; w += 4) {
+        v = *(const bitVec *) (row + w) & ~*(const bitVec *) (seen + w);
+        *(bitVec *) (fresh + w) = v;
+        count += __builtin_popcountll(v[0]) + __builtin_popcountll(v[1]) +
+                 __builtin_popcountll(v[2]) + __builtin_popcountll(v[3]);
+    }
+
+    return count;
+
+}
+
+
+// *****************************************************************************
+//
+// nthBit(const uint64_t *bits, int n)
+//
+// Purpose: Find the n-th (from 0) set bit of a bitset that has more than
+//          n bits set. Whole words are skipped by their popcount, then
+//          the lowest set bits of the right word are cleared until the
+//          one wanted is lowest.
+//
+// *****************************************************************************
+//
+static int nthBit(const uint64_t *bits, int n) {
+
+    int w = 0;           // word holding the bit
+    int count;           // bits set in word w
+
+    uint64_t word;       // word w, losing its lowest bits
+
+    while((count = __builtin_popcountll(bits[w])) <= n) {
+        n -= count;
+        w++;
+    }
+    word = bits[w];
+    while(n-- > 0) {
+        word &= word - 1;
+    }
+
+    return w * 64 + __builtin_ctzll(word);
+
+}
+
+
+// *****************************************************************************
+//
+// walkOnce(struct World *world, int startRoom, enum strategy strategy,
+//          struct Rng *rng)
+//
+// Purpose: Play one simulated game by the playGame() rules. Every move
+//          is to an adjacent Room, so every move is a step. Returns the
+//          number of steps it took to find the END ROOM, or 0 if the
+//          player ran out of steps.
+//
+// *****************************************************************************
+//
+static int walkOnce(struct World *world, int startRoom,
+                    enum strategy strategy, struct Rng *rng) {
+
+    int x, v;            // loop iterators
+    int steps;           // steps taken so far
+    int curr = startRoom; // Room the player is in
+    int fresh;           // neighbours not visited yet
+    int next;            // Room to move to
+
+    int visited[MAX_PATH + 1]; // Rooms seen so far (for GREEDY_WALK)
+    int numVisited = 1;  // entries in visited[]
+
+    uint64_t seen[BITSET_ROOMS / 64];   // visited[] as bits, with adjBits[]
+    uint64_t freshBits[BITSET_ROOMS / 64]; // neighbours not visited yet
+
+    int32_t *adj;        // the current Room's neighbours
+    struct Room *room;   // the current Room
+
+    int useBits = (strategy == GREEDY_WALK && world->adjBits != NULL);
+
+    visited[0] = startRoom;
+    if(useBits) {
+        memset(seen, 0, sizeof(uint64_t) * world->bitWords);
+        seen[startRoom >> 6] |= 1ULL << (startRoom & 63);
+    }
+
+    for(steps = 1; steps <= MAX_PATH; steps++) {
+        room = &world->rooms[curr];
+        adj = world->adjList + room->adjStart;
+        if(room->adjCount == 0) {
+            return 0;
+        }
+
+        // A greedy player never goes back while there is somewhere new
+        // to go. In a small World that is one intersection of bitsets;
+        // otherwise the path is at most MAX_PATH long, so a plain scan
+        // of it is quicker than anything cleverer. adjList[] slices are
+        // sorted, as are set bits, so both pick the same Room.
+        //
+        next = -1;
+        if(useBits) {
+            fresh = freshRooms(world->adjBits + (size_t) curr * world->bitWords,
+                               seen, freshBits, world->bitWords);
+            if(fresh > 0) {
+                next = nthBit(freshBits, rngBounded(rng, fresh));
+            }
+        } else if(strategy == GREEDY_WALK) {
+            fresh = 0;
+            for(x = 0; x < room->adjCount; x++) {
+                for(v = 0; v < numVisited && visited[v] != adj[x]; v++) {
+                }
+                fresh += (v == numVisited);
+            }
+            if(fresh > 0) {
+                fresh = rngBounded(rng, fresh);
+                for(x = 0; ; x++) {
+                    for(v = 0; v < numVisited && visited[v] != adj[x]; v++) {
+                    }
+                    if(v == numVisited && fresh-- == 0) {
+                        break;
+                    }
+                }
+                next = adj[x];
+            }
+        }
+        if(next < 0) {
+            next = adj[rngBounded(rng, room->adjCount)];
+        }
+
+        curr = next;
+        if(world->rooms[curr].type == END_ROOM) {
+            return steps;
+        }
+        visited[numVisited++] = curr;
+        if(useBits) {
+            seen[curr >> 6] |= 1ULL << (curr & 63);
+        }
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+//
+// walkWorker(void *arg)
+//
+// Purpose: Play one worker's blocks of simulated games.
+//
+// *****************************************************************************
+//
+static void *walkWorker(void *arg) {
+
+    struct WalkTask *task = (struct WalkTask *) arg;
+
+    long long b, p;      // loop iterators
+    long long inBlock;   // players in the block
+    int s;               // strategy being played
+    int steps;           // steps walkOnce() took to win, or 0
+
+    struct Rng rng;      // the block's random number stream
+
+    for(b = task->first; b < task->last; b++) {
+        rngSeed(&rng, task->seed, ANALYZE_STREAM + b);
+        inBlock = task->players - b * ANALYZE_BLOCK;
+        if(inBlock > ANALYZE_BLOCK) {
+            inBlock = ANALYZE_BLOCK;
+        }
+        for(p = 0; p < inBlock; p++) {
+            for(s = 0; s < NUM_STRATEGIES; s++) {
+                steps = walkOnce(task->world, task->startRoom, s, &rng);
+                if(steps > 0) {
+                    task->wins[s]++;
+                    task->winSteps[s] += steps;
+                    task->lengths[s][steps]++;
+                }
+            }
+        }
+    }
+
+    return NULL;
+
+}
+
+
+// *****************************************************************************
+//
+// analyzeWorld(struct World *world, uint64_t seed, long long players,
+//              int numThreads, struct Analysis *analysis)
+//
+// Purpose: Play players simulated games per strategy on one World,
+//          spread over numThreads threads, and add them to analysis.
+//
+// *****************************************************************************
+//
+static void analyzeWorld(struct World *world, uint64_t seed,
+                         long long players, int numThreads,
+                         struct Analysis *analysis) {
+
+    int s, t, n;         // loop iterators
+    int numTasks;        // number of worker threads
+    int bucket;          // win rate bucket of the World
+    int startRoom;       // where every game begins
+
+    long long numBlocks; // blocks of ANALYZE_BLOCK players
+    long long wins;      // games won on this World
+
+    double rate;         // win rate on this World
+
+    struct WalkTask tasks[MAX_THREADS]; // one per worker thread
+
+    startRoom = findStartRoom(world);
+    numBlocks = (players + ANALYZE_BLOCK - 1) / ANALYZE_BLOCK;
+    numTasks = (numThreads < numBlocks ? numThreads : (int) numBlocks);
+
+    memset(tasks, 0, sizeof(struct WalkTask) * numTasks);
+    for(t = 0; t < numTasks; t++) {
+        tasks[t].world = world;
+        tasks[t].seed = seed;
+        tasks[t].players = players;
+        tasks[t].first = numBlocks * t / numTasks;
+        tasks[t].last = numBlocks * (t + 1) / numTasks;
+        tasks[t].startRoom = startRoom;
+    }
+    if(startRoom >= 0) {
+        runWorkers(walkWorker, tasks, sizeof(struct WalkTask), numTasks);
+    }
+
+    // Add up the workers' counts and file the World under its win rate.
+    //
+    for(s = 0; s < NUM_STRATEGIES; s++) {
+        wins = 0;
+        for(t = 0; t < numTasks; t++) {
+            wins += tasks[t].wins[s];
+            analysis->winSteps[s] += tasks[t].winSteps[s];
+            for(n = 1; n <= MAX_PATH; n++) {
+                analysis->lengths[s][n] += tasks[t].lengths[s][n];
+            }
+        }
+
+        rate = (players > 0 ? (double) wins / players : 0.0);
+        bucket = (int) (rate * 10);
+        analysis->rates[s][bucket > 10 ? 10 : bucket]++;
+        if(analysis->walks[s] == 0 || rate < analysis->lowRate[s]) {
+            analysis->lowRate[s] = rate;
+        }
+        if(analysis->walks[s] == 0 || rate > analysis->highRate[s]) {
+            analysis->highRate[s] = rate;
+        }
+        analysis->walks[s] += players;
+        analysis->wins[s] += wins;
+    }
+
+}
+
+
+// *****************************************************************************
+//
+// runAnalysis(struct GenParams *params, char *roomNames[],
+//             struct World *world, long long players, int numWorlds)
+//
+// Purpose: Estimate how hard Worlds are by simulating players.
+//
+// *****************************************************************************
+//
+int runAnalysis(struct GenParams *params, char *roomNames[],
+                struct World *world, long long players, int numWorlds) {
+
+    int s, w, n;         // loop iterators
+
+    double seconds;      // time taken by the whole analysis
+
+    struct GenParams worldParams = *params; // how to build each World
+    struct World generated = {0};  // World being analyzed, if generated
+    struct Analysis analysis;      // what has been learned so far
+
+    static const char *strategyNames[NUM_STRATEGIES] = { "random", "greedy" };
+
+    memset(&analysis, 0, sizeof(analysis));
+    seconds = nowSeconds();
+
+    // Every World is played with the seed it was built with, so any
+    // World in the report can be built again with --seed.
+    //
+    for(w = 0; w < numWorlds; w++) {
+        if(world == NULL) {
+            worldParams.seed = params->seed + w;
+            generateRooms(&generated, &worldParams, roomNames);
+            analyzeWorld(&generated, worldParams.seed, players,
+                         params->numThreads, &analysis);
+            cleanRooms(&generated);
+        } else {
+            analyzeWorld(world, params->seed, players, params->numThreads,
+                         &analysis);
+        }
+    }
+
+    seconds = nowSeconds() - seconds;
+
+    // The summary first, then how the win rates of the Worlds spread
+    // out, then how long the winning games took.
+    //
+    printf("ANALYSIS: %d WORLD%s OF %d ROOMS, SEED %llu, "
+           "%lld GAMES PER WORLD AND STRATEGY, MAX_PATH %d\n",
+           numWorlds, (numWorlds > 1 ? "S" : ""),
+           (world == NULL ? params->numRooms : world->numRooms),
+           (unsigned long long) params->seed, players, MAX_PATH);
+    printf("%-10s %10s %12s %12s %12s\n", "STRATEGY", "WIN RATE",
+           "MEAN STEPS", "WORST WORLD", "BEST WORLD");
+    for(s = 0; s < NUM_STRATEGIES; s++) {
+        printf("%-10s %9.2f%% %12.2f %11.2f%% %11.2f%%\n", strategyNames[s],
+               100.0 * analysis.wins[s] / analysis.walks[s],
+               (analysis.wins[s] > 0 ?
+                (double) analysis.winSteps[s] / analysis.wins[s] : 0.0),
+               100.0 * analysis.lowRate[s], 100.0 * analysis.highRate[s]);
+    }
+
+    printf("\nWIN RATE DISTRIBUTION (WORLDS)\n%-10s", "WIN RATE");
+    for(s = 0; s < NUM_STRATEGIES; s++) {
+        printf(" %10s", strategyNames[s]);
+    }
+    printf("\n");
+    for(n = 0; n <= 10; n++) {
+        if(n < 10) {
+            printf("%3d-%3d%%  ", n * 10, n * 10 + 10);
+        } else {
+            printf("%-10s", "100%");
+        }
+        for(s = 0; s < NUM_STRATEGIES; s++) {
+            printf(" %10d", analysis.rates[s][n]);
+        }
+        printf("\n");
+    }
+
+    printf("\nPATH LENGTH HISTOGRAM (GAMES WON)\n%-10s", "STEPS");
+    for(s = 0; s < NUM_STRATEGIES; s++) {
+        printf(" %10s", strategyNames[s]);
+    }
+    printf("\n");
+    for(n = 1; n <= MAX_PATH; n++) {
+        printf("%-10d", n);
+        for(s = 0; s < NUM_STRATEGIES; s++) {
+            printf(" %10lld", analysis.lengths[s][n]);
+        }
+        printf("\n");
+    }
+
+    fflush(stdout);
+    fprintf(stderr, "ANALYSIS: %lld games in %.3f s: %.0f games/s\n",
+            analysis.walks[0] * NUM_STRATEGIES, seconds,
+            (seconds > 0 ? analysis.walks[0] * NUM_STRATEGIES / seconds : 0.0));
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// emptyDir(DIR *dp)
+//
+// Purpose: Delete everything in a directory, including the shard
+//          subdirectories of a sharded Room file directory.
+//
+// *****************************************************************************
+//
+static void emptyDir(DIR *dp) {
+
+    int subFd;                // descriptor of a subdirectory
+    DIR *subDp;               // the subdirectory, opened for reading
+    struct dirent *dirFiles;  // struct that holds directory data
+
+    while((dirFiles = readdir(dp)) != NULL) {
+        if(strcmp(dirFiles->d_name, ".") == 0 ||
+           strcmp(dirFiles->d_name, "..") == 0 ||
+           unlinkat(dirfd(dp), dirFiles->d_name, 0) == 0) {
+            continue;
+        }
+
+        // It would not unlink, so it is a subdirectory. Empty it first.
+        //
+        subFd = openat(dirfd(dp), dirFiles->d_name, O_RDONLY | O_DIRECTORY);
+        subDp = (subFd >= 0 ? fdopendir(subFd) : NULL);
+        if(subDp != NULL) {
+            emptyDir(subDp);
+            closedir(subDp);
+            unlinkat(dirfd(dp), dirFiles->d_name, AT_REMOVEDIR);
+        }
+    }
+
+}
+
+
+// *****************************************************************************
+// 
+// removeWorld(char worldName[])
+//
+// Purpose: Delete a World from disk.
+//
+// *****************************************************************************
+//
+int removeWorld(char worldName[]) {
+
+    DIR  *dp = NULL;          // directory pointer
+
+    // A world file is just one file.
+    //
+    dp = opendir(worldName);
+    if(dp == NULL) {
+        return (unlink(worldName) == 0 ? 0 : 1);
+    }
+
+    // A Room file directory has to be emptied before it can go.
+    //
+    emptyDir(dp);
+    closedir(dp);
+
+    return (rmdir(worldName) == 0 ? 0 : 1);
+
+}
+
+
+// *****************************************************************************
+// 
+// nowSeconds(void)
+//
+// Purpose: Read the monotonic clock.
+//
+// *****************************************************************************
+//
+double nowSeconds(void) {
+
+    struct timespec now;      // the time right now
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+
+}
+
+
+// *****************************************************************************
+// 
+// statsStart(void)
+//
+// Purpose: Start timing a phase.
+//
+// *****************************************************************************
+//
+double statsStart(void) {
+
+    return (stats.format != STATS_OFF ? nowSeconds() : 0.0);
+
+}
+
+
+// *****************************************************************************
+// 
+// statsStop(enum phase phase, double start)
+//
+// Purpose: Add the time since start to the phase's total.
+//
+// *****************************************************************************
+//
+void statsStop(enum phase phase, double start) {
+
+    if(stats.format != STATS_OFF) {
+        stats.phaseSeconds[phase] += nowSeconds() - start;
+    }
+
+}
+
+
+// *****************************************************************************
+// 
+// monoMicros(void)
+//
+// Purpose: Read the monotonic clock in whole microseconds.
+//
+// *****************************************************************************
+//
+static uint64_t monoMicros(void) {
+
+    struct timespec now;      // the time right now
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+}
+
+
+// *****************************************************************************
+// 
+// putVarint(unsigned char *out, uint64_t value)
+//
+// Purpose: Encode value as a varint: 7 bits per byte, low bits first,
+//          with the top bit set on every byte but the last. Returns the
+//          number of bytes used (at most 10).
+//
+// *****************************************************************************
+//
+static int putVarint(unsigned char *out, uint64_t value) {
+
+    int n = 0;           // bytes used so far
+
+    while(value >= 0x80) {
+        out[n++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char) value;
+
+    return n;
+
+}
+
+
+// *****************************************************************************
+// 
+// getVarint(const unsigned char **in, const unsigned char *end,
+//           uint64_t *value)
+//
+// Purpose: Decode one varint written by putVarint() and move *in past
+//          it. Returns 0, or -1 if the buffer ends first or the varint
+//          is too long.
+//
+// *****************************************************************************
+//
+static int getVarint(const unsigned char **in, const unsigned char *end,
+                     uint64_t *value) {
+
+    int shift;           // where the next 7 bits go
+
+    const unsigned char *p = *in; // next byte to decode
+
+    *value = 0;
+    for(shift = 0; shift < 64 && p < end; shift += 7) {
+        *value |= (uint64_t) (*p & 0x7f) << shift;
+        if((*p++ & 0x80) == 0) {
+            *in = p;
+            return 0;
+        }
+    }
+
+    return -1;
+
+}
+
+
+// *****************************************************************************
+// 
+// journalWriter(void *arg)
+//
+// Purpose: Drain the journal ring until journalClose() stops it. Each
+//          event is written as its kind (one byte), then varints of the
+//          session, the room plus one (0 for none) and the microseconds
+//          since the event before it.
+//
+// *****************************************************************************
+//
+static void *journalWriter(void *arg) {
+
+    uint64_t i;          // loop iterator
+    uint64_t head;       // events queued so far
+    uint64_t tail;       // events written so far
+    uint64_t last;       // when the last event written happened
+    int stop;            // 1 once journalClose() has been called
+    size_t len;          // bytes encoded into out[]
+
+    unsigned char *out;  // encoded events, written in one go
+
+    struct JournalEvent *event; // event being encoded
+    struct timespec idle = { 0, JOURNAL_POLL * 1000 }; // sleep when idle
+
+    (void) arg;
+
+    // The writer never exits the program itself: exit() would run
+    // journalClose(), which waits for this very thread. It sets error
+    // and returns instead, and the game loop reports it.
+    //
+    out = (unsigned char *) malloc(JOURNAL_CHUNK * JOURNAL_RECORD);
+    if(out == NULL) {
+        __atomic_store_n(&journal.error, ENOMEM, __ATOMIC_RELEASE);
+        return NULL;
+    }
+
+    last = journal.baseMicros;
+    tail = journal.tail;
+    for(;;) {
+        // Look at stop before head: once stop is seen, head already
+        // counts every event queued before journalClose().
+        //
+        stop = __atomic_load_n(&journal.stop, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&journal.head, __ATOMIC_ACQUIRE);
+        if(head == tail) {
+            if(stop) {
+                break;
+            }
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        if(head - tail > JOURNAL_CHUNK) {
+            head = tail + JOURNAL_CHUNK;
+        }
+
+        len = 0;
+        for(i = tail; i < head; i++) {
+            event = &journal.ring[i & (JOURNAL_RING - 1)];
+            out[len++] = (unsigned char) event->kind;
+            len += putVarint(out + len, event->session);
+            len += putVarint(out + len, (uint64_t) (event->room + 1));
+            len += putVarint(out + len, event->micros - last);
+            last = event->micros;
+        }
+
+        // The events are copied out, so their slots can be reused while
+        // the write is going on.
+        //
+        tail = head;
+        __atomic_store_n(&journal.tail, tail, __ATOMIC_RELEASE);
+        if(writeWhole(journal.fd, (const char *) out, len) != 0) {
+            __atomic_store_n(&journal.error, errno, __ATOMIC_RELEASE);
+            break;
+        }
+        STAT_ADD(bytesWritten, len);
+    }
+
+    free(out);
+
+    return NULL;
+
+}
+
+
+// *****************************************************************************
+// 
+// journalOpen(char fileName[], int numRooms)
+//
+// Purpose: Start journaling.
+//
+// *****************************************************************************
+//
+int journalOpen(char fileName[], int numRooms) {
+
+    size_t len = 0;      // bytes of header encoded
+
+    unsigned char header[64]; // the run header
+
+    struct timespec now; // wall clock time the run began
+
+    // Only one run may append at a time, or their records would mix.
+    //
+    journal.fd = open(fileName, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                      0644);
+    if(journal.fd < 0) {
+        printf("Error opening %s: errno = %d\n", fileName, errno);
+        return 1;
+    }
+    STAT_ADD(filesOpened, 1);
+    if(flock(journal.fd, LOCK_EX | LOCK_NB) != 0) {
+        printf("Error locking %s: errno = %d\n", fileName, errno);
+        close(journal.fd);
+        journal.fd = -1;
+        return 1;
+    }
+
+    journal.ring = (struct JournalEvent *) malloc(sizeof(struct JournalEvent) *
+                                                  JOURNAL_RING);
+    if(journal.ring == NULL) {
+        printf("Error allocating the journal ring\n");
+        exit(1);
+    }
+
+    // The run header: a zero kind and JOURNAL_MAGIC, so a reader can
+    // find the next run after a damaged one, then varints of the
+    // version, the wall clock time in microseconds, the process id and
+    // the number of Rooms.
+    //
+    clock_gettime(CLOCK_REALTIME, &now);
+    journal.baseMicros = monoMicros();
+    header[len++] = JOURNAL_RUN;
+    memcpy(header + len, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1);
+    len += sizeof(JOURNAL_MAGIC) - 1;
+    len += putVarint(header + len, JOURNAL_VERSION);
+    len += putVarint(header + len, (uint64_t) now.tv_sec * 1000000 +
+                                   now.tv_nsec / 1000);
+    len += putVarint(header + len, (uint64_t) getpid());
+    len += putVarint(header + len, (uint64_t) numRooms);
+    if(writeWhole(journal.fd, (const char *) header, len) != 0) {
+        printf("Error writing %s: errno = %d\n", fileName, errno);
+        return 1;
+    }
+    STAT_ADD(bytesWritten, len);
+
+    if(pthread_create(&journal.writer, NULL, journalWriter, NULL) != 0) {
+        printf("Error creating the journal writer thread\n");
+        exit(1);
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// journalSession(void)
+//
+// Purpose: Number a game for its journal events.
+//
+// *****************************************************************************
+//
+uint32_t journalSession(void) {
+
+    return (journal.fd >= 0 ? journal.nextSession++ : 0);
+
+}
+
+
+// *****************************************************************************
+// 
+// journalEvent(uint32_t session, enum journalKind kind, int room)
+//
+// Purpose: Queue one event for the journal writer.
+//
+// *****************************************************************************
+//
+void journalEvent(uint32_t session, enum journalKind kind, int room) {
+
+    uint64_t head = journal.head; // only this thread moves head
+
+    struct JournalEvent *event;   // the slot being filled
+    struct timespec wait = { 0, 50000 }; // back-off while ring[] is full
+
+    // The writer has given up, so stop here; journalClose() says why.
+    //
+    if(__atomic_load_n(&journal.error, __ATOMIC_ACQUIRE) != 0) {
+        exit(1);
+    }
+
+    // The writer is a whole ring behind; give it a moment, unless it
+    // gives up in the meantime.
+    //
+    while(head - journal.tailSeen >= JOURNAL_RING) {
+        journal.tailSeen = __atomic_load_n(&journal.tail, __ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&journal.error, __ATOMIC_ACQUIRE) != 0) {
+            exit(1);
+        }
+        if(head - journal.tailSeen >= JOURNAL_RING) {
+            journal.waits++;
+            nanosleep(&wait, NULL);
+        }
+    }
+
+    event = &journal.ring[head & (JOURNAL_RING - 1)];
+    event->micros = monoMicros();
+    event->session = session;
+    event->room = room;
+    event->kind = kind;
+    __atomic_store_n(&journal.head, head + 1, __ATOMIC_RELEASE);
+
+}
+
+
+// *****************************************************************************
+// 
+// journalClose(void)
+//
+// Purpose: Write out every queued event and stop journaling.
+//
+// *****************************************************************************
+//
+void journalClose(void) {
+
+    if(journal.fd < 0) {
+        return;
+    }
+
+    __atomic_store_n(&journal.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(journal.writer, NULL);
+    close(journal.fd);
+    journal.fd = -1;
+    free(journal.ring);
+    journal.ring = NULL;
+
+    if(journal.error != 0) {
+        printf("Error writing the journal: errno = %d\n", journal.error);
+    }
+    if(journal.waits > 0) {
+        fprintf(stderr, "JOURNAL: the game waited on the writer %lld "
+                "time%s\n", journal.waits, (journal.waits == 1 ? "" : "s"));
+    }
+
+}
+
+
+// struct JournalRun: What readJournal() adds up, for one run or for the
+// whole file.
+//
+// sessions   -> Games started.
+//
+// events[]   -> Records of each kind (enum journalKind).
+//
+// winSteps   -> Steps taken in the games won.
+//
+// playMicros -> Time from start to end of the games that ended.
+//
+struct JournalRun {
+    long long sessions;
+    long long events[NUM_JOURNAL_KINDS];
+    long long winSteps;
+    uint64_t playMicros;
+};
+
+
+// *****************************************************************************
+// 
+// addJournalRun(struct JournalRun *total, struct JournalRun *run)
+//
+// Purpose: Add one run's counts to the totals.
+//
+// *****************************************************************************
+//
+static void addJournalRun(struct JournalRun *total, struct JournalRun *run) {
+
+    int k;               // loop iterator
+
+    total->sessions += run->sessions;
+    for(k = 0; k < NUM_JOURNAL_KINDS; k++) {
+        total->events[k] += run->events[k];
+    }
+    total->winSteps += run->winSteps;
+    total->playMicros += run->playMicros;
+
+}
+
+
+// *****************************************************************************
+// 
+// printJournalRun(const char *label, struct JournalRun *run)
+//
+// Purpose: Print what a run (or the whole journal) holds.
+//
+// *****************************************************************************
+//
+static void printJournalRun(const char *label, struct JournalRun *run) {
+
+    long long ended;     // games that were won, lost or quit
+
+    ended = run->events[JOURNAL_WIN] + run->events[JOURNAL_LOSE] +
+            run->events[JOURNAL_QUIT];
+    printf("%s: %lld SESSIONS (%lld WON, %lld LOST, %lld QUIT, %lld "
+           "UNFINISHED)\n", label, run->sessions, run->events[JOURNAL_WIN],
+           run->events[JOURNAL_LOSE], run->events[JOURNAL_QUIT],
+           run->sessions - ended);
+    printf("%*s  %lld MOVES, %lld REJECTED, %lld HINTS", (int) strlen(label),
+           "", run->events[JOURNAL_MOVE], run->events[JOURNAL_REJECT],
+           run->events[JOURNAL_HINT]);
+    if(run->events[JOURNAL_WIN] > 0) {
+        printf(", %.2f STEPS PER WIN",
+               (double) run->winSteps / run->events[JOURNAL_WIN]);
+    }
+    if(ended > 0) {
+        printf(", %.3f S PER GAME", run->playMicros / 1e6 / ended);
+    }
+    printf("\n");
+
+}
+
+
+// *****************************************************************************
+// 
+// readJournal(char fileName[])
+//
+// Purpose: Decode a journal and print what it holds.
+//
+// *****************************************************************************
+//
+int readJournal(char fileName[]) {
+
+    int fd;              // journal file descriptor
+    int kind;            // kind of the record being decoded
+    int k;               // loop iterator
+    int numRuns = 0;     // runs found
+    int damaged = 0;     // damaged stretches skipped
+
+    uint64_t session;    // session of the record
+    uint64_t room;       // Room of the record, plus one
+    uint64_t delta;      // microseconds since the record before
+    uint64_t now = 0;    // microseconds since the run began
+    uint64_t version, wall, pid, numRooms; // fields of a run header
+
+    long fileLen;        // bytes in the journal
+    size_t bufSize = 1 << 20; // bytes allocated for buf
+
+    char *buf;           // the whole journal
+    char label[32];      // how a run is labelled in the report
+    char when[64];       // wall clock time a run began
+
+    time_t wallSecs;     // wall as a time_t
+
+    const unsigned char *cursor; // next byte to decode
+    const unsigned char *end;    // end of the journal
+    const unsigned char *record; // start of the record being decoded
+    const unsigned char *magic;  // next run header after damage
+
+    uint64_t *starts = NULL;   // when each session of the run began
+    int *steps = NULL;         // steps taken by each session of the run
+    uint64_t numSlots = 0;     // entries allocated in starts and steps
+    uint64_t oldSlots;         // numSlots before growing the arrays
+    long long numEvents = 0;   // records of every kind but JOURNAL_RUN
+    void *grown;               // starts or steps after growing them
+
+    double seconds;      // time taken to decode
+
+    struct JournalRun run;     // counts for the run being decoded
+    struct JournalRun total;   // counts for the whole journal
+
+    fd = open(fileName, O_RDONLY);
+    buf = (char *) malloc(bufSize);
+    if(fd < 0 || buf == NULL) {
+        printf("Error opening %s: errno = %d\n", fileName, errno);
+        return 1;
+    }
+    STAT_ADD(filesOpened, 1);
+    fileLen = readWhole(fd, &buf, &bufSize);
+    close(fd);
+    if(fileLen < 0) {
+        printf("Error reading %s: errno = %d\n", fileName, errno);
+        return 1;
+    }
+    STAT_ADD(bytesRead, fileLen);
+
+    seconds = nowSeconds();
+    memset(&run, 0, sizeof(run));
+    memset(&total, 0, sizeof(total));
+    cursor = (const unsigned char *) buf;
+    end = cursor + fileLen;
+
+    while(cursor < end) {
+        record = cursor;
+        kind = *cursor++;
+
+        // A run header: finish the run before it and start counting
+        // afresh. Session numbers start again at 0 in every run.
+        //
+        if(kind == JOURNAL_RUN) {
+            if(end - cursor >= (long) sizeof(JOURNAL_MAGIC) - 1 &&
+               memcmp(cursor, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1) == 0) {
+                cursor += sizeof(JOURNAL_MAGIC) - 1;
+                if(getVarint(&cursor, end, &version) == 0 &&
+                   version == JOURNAL_VERSION &&
+                   getVarint(&cursor, end, &wall) == 0 &&
+                   getVarint(&cursor, end, &pid) == 0 &&
+                   getVarint(&cursor, end, &numRooms) == 0) {
+                    if(numRuns > 0) {
+                        snprintf(label, sizeof(label), "RUN %d", numRuns);
+                        printJournalRun(label, &run);
+                        addJournalRun(&total, &run);
+                    }
+                    memset(&run, 0, sizeof(run));
+                    now = 0;
+                    numRuns++;
+                    wallSecs = (time_t) (wall / 1000000);
+                    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S",
+                             localtime(&wallSecs));
+                    printf("RUN %d: STARTED %s, PID %llu, %llu ROOMS\n",
+                           numRuns, when, (unsigned long long) pid,
+                           (unsigned long long) numRooms);
+                    continue;
+                }
+            }
+        } else if(kind < NUM_JOURNAL_KINDS && numRuns > 0 &&
+                  getVarint(&cursor, end, &session) == 0 &&
+                  getVarint(&cursor, end, &room) == 0 &&
+                  getVarint(&cursor, end, &delta) == 0 &&
+                  session < (1U << 30)) {
+            now += delta;
+            run.events[kind]++;
+
+            // Sessions are numbered from 0 in each run, so their start
+            // times and steps can live in plain arrays.
+            //
+            if(session >= numSlots) {
+                oldSlots = numSlots;
+                while(session >= numSlots) {
+                    numSlots = (numSlots > 0 ? numSlots * 2 : 1024);
+                }
+                grown = realloc(starts, sizeof(uint64_t) * numSlots);
+                if(grown == NULL) {
+                    printf("Error allocating %llu sessions\n",
+                           (unsigned long long) numSlots);
+                    exit(1);
+                }
+                starts = (uint64_t *) grown;
+                grown = realloc(steps, sizeof(int) * numSlots);
+                if(grown == NULL) {
+                    printf("Error allocating %llu sessions\n",
+                           (unsigned long long) numSlots);
+                    exit(1);
+                }
+                steps = (int *) grown;
+                memset(starts + oldSlots, 0,
+                       sizeof(uint64_t) * (numSlots - oldSlots));
+                memset(steps + oldSlots, 0,
+                       sizeof(int) * (numSlots - oldSlots));
+            }
+
+            if(kind == JOURNAL_START) {
+                run.sessions++;
+                starts[session] = now;
+                steps[session] = 0;
+            } else if(kind == JOURNAL_MOVE) {
+                steps[session]++;
+            } else if(kind == JOURNAL_WIN || kind == JOURNAL_LOSE ||
+                      kind == JOURNAL_QUIT) {
+                run.playMicros += now - starts[session];
+                if(kind == JOURNAL_WIN) {
+                    run.winSteps += steps[session];
+                }
+            }
+            continue;
+        }
+
+        // Not a record: a run cut short by a crash, most likely. Carry
+        // on from the next run header, if there is one.
+        //
+        damaged++;
+        magic = (const unsigned char *) memmem(record + 1, end - record - 1,
+                                               JOURNAL_MAGIC,
+                                               sizeof(JOURNAL_MAGIC) - 1);
+        cursor = (magic != NULL ? magic - 1 : end);
+        printf("DAMAGED RECORD AT BYTE %ld, SKIPPED %ld BYTES\n",
+               (long) (record - (const unsigned char *) buf),
+               (long) (cursor - record));
+    }
+
+    if(numRuns > 0) {
+        snprintf(label, sizeof(label), "RUN %d", numRuns);
+        printJournalRun(label, &run);
+        addJournalRun(&total, &run);
+    }
+    if(numRuns > 1) {
+        printJournalRun("TOTAL", &total);
+    }
+
+    seconds = nowSeconds() - seconds;
+    for(k = JOURNAL_START; k < NUM_JOURNAL_KINDS; k++) {
+        numEvents += total.events[k];
+    }
+    fflush(stdout);
+    fprintf(stderr, "JOURNAL: %d run%s, %lld events in %ld bytes%s, "
+            "decoded in %.3f s: %.0f events/s\n", numRuns,
+            (numRuns == 1 ? "" : "s"), numEvents, fileLen,
+            (damaged > 0 ? " (damaged)" : ""), seconds,
+            (seconds > 0 ? numEvents / seconds : 0.0));
+
+    free(starts);
+    free(steps);
+    free(buf);
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// dumpStats(void)
+//
+// Purpose: Write out the phase timings and counters.
+//
+// *****************************************************************************
+//
+void dumpStats(void) {
+
+    int i;               // loop iterator
+
+    FILE *fp = stderr;   // where the stats go
+
+    // Phase names, in enum phase order.
+    //
+    static const char *phaseNames[NUM_PHASES] = {
+        "mkdir", "generate", "write", "load", "export", "play" };
+
+    // Counter names and values, in the same order for both formats.
+    //
+    const char *counterNames[] = {
+        "files_opened", "bytes_read", "bytes_written", "bytes_mapped",
+        "stat_calls", "dirs_created", "dir_entries", "moves_processed" };
+    long long counters[] = {
+        stats.filesOpened, stats.bytesRead, stats.bytesWritten,
+        stats.bytesMapped, stats.statCalls, stats.dirsCreated,
+        stats.dirEntries, stats.movesProcessed };
+    int numCounters = sizeof(counters) / sizeof(counters[0]);
+
+    if(stats.outName != NULL) {
+        fp = fopen(stats.outName, "w");
+        if(fp == NULL) {
+            fprintf(stderr, "Error opening %s: errno = %d\n", stats.outName,
+                    errno);
+            return;
+        }
+    }
+
+    if(stats.format == STATS_JSON) {
+        fprintf(fp, "{\"phase_seconds\": {");
+        for(i = 0; i < NUM_PHASES; i++) {
+            fprintf(fp, "%s\"%s\": %.6f", (i == 0 ? "" : ", "),
+                    phaseNames[i], stats.phaseSeconds[i]);
+        }
+        fprintf(fp, "}, \"counters\": {");
+        for(i = 0; i < numCounters; i++) {
+            fprintf(fp, "%s\"%s\": %lld", (i == 0 ? "" : ", "),
+                    counterNames[i], counters[i]);
+        }
+        fprintf(fp, "}}\n");
+    } else {
+        fprintf(fp, "# HELP adventure_phase_seconds Time spent in each "
+                "phase of the run.\n");
+        fprintf(fp, "# TYPE adventure_phase_seconds gauge\n");
+        for(i = 0; i < NUM_PHASES; i++) {
+            fprintf(fp, "adventure_phase_seconds{phase=\"%s\"} %.6f\n",
+                    phaseNames[i], stats.phaseSeconds[i]);
+        }
+        for(i = 0; i < numCounters; i++) {
+            fprintf(fp, "# TYPE adventure_%s_total counter\n", counterNames[i]);
+            fprintf(fp, "adventure_%s_total %lld\n", counterNames[i],
+                    counters[i]);
+        }
+    }
+
+    if(fp != stderr) {
+        fclose(fp);
+    }
+
+}
+
+
+// *****************************************************************************
+// 
+// findStartRoom(struct World *world)
+//
+// Purpose: Find where every game begins.
+//
+// *****************************************************************************
+//
+int findStartRoom(struct World *world) {
+
+    int i;    // loop iterator
+
+    // A lazily loaded World learned its START ROOM when it was opened.
+    //
+    if(world->lazy != NULL) {
+        return world->lazy->startRoom;
+    }
+
+    for(i = 0; i < world->numRooms; i++) {
+        if(world->rooms[i].type == START_ROOM) {
+            return i;
+        }
+    }
+
+    return -1;
+
+}
+
+
+// *****************************************************************************
+// 
+// moveRoom(struct World *world, int currRoom, char name[])
+//
+// Purpose: Apply the game's movement rule to one move.
+//
+// *****************************************************************************
+//
+int moveRoom(struct World *world, int currRoom, char name[]) {
+
+    int room;            // Room the name belongs to
+
+    // First, look up the name in the name index...
+    //
+    room = findRoom(world, name);
+    if(room < 0) {
+        STAT_ADD(movesProcessed, 1);
+        return -1;
+    }
+
+    // ...next, see if that Room is adjacent.
+    //
+    return moveRoomIndex(world, currRoom, room);
+
+}
+
+
+// *****************************************************************************
+// 
+// moveRoomIndex(struct World *world, int currRoom, int room)
+//
+// Purpose: Apply the game's movement rule to a move given by index.
+//
+// *****************************************************************************
+//
+int moveRoomIndex(struct World *world, int currRoom, int room) {
+
+    int x;               // loop iterator
+
+    int32_t *adj;        // the current Room's slice of adjList[]
+
+    struct Room *curr = &world->rooms[currRoom];
+
+    STAT_ADD(movesProcessed, 1);
+
+    if(room < 0 || room >= world->numRooms) {
+        return -1;
+    }
+
+    // One bit of adjBits[] in a small World, otherwise a look through
+    // the current Room's slice of adjList[].
+    //
+    if(world->adjBits != NULL) {
+        return ((world->adjBits[(size_t) currRoom * world->bitWords +
+                                (room >> 6)] >> (room & 63)) & 1 ?
+                room : -1);
+    }
+    adj = __atomic_load_n(&world->adjList, __ATOMIC_ACQUIRE) + curr->adjStart;
+    for(x = 0; x < curr->adjCount; x++) {
+        if(adj[x] == room) {
+            return room;
+        }
+    }
+
+    return -1;
+
+}
+
+
+// *****************************************************************************
+// 
+// computeDistances(struct World *world)
+//
+// Purpose: Work out every Room's distance from the END ROOM.
+//
+// *****************************************************************************
+//
+int computeDistances(struct World *world) {
+
+    int i, x;            // loop iterators
+    int room;            // Room taken off the queue
+    int from;            // Room with a connection into room
+    int head = 0;        // next entry of queue[] to take
+    int tail = 0;        // next free entry of queue[]
+
+    int32_t *inStart;    // where each Room's slice of inList[] starts
+    int32_t *inList;     // Rooms with a connection into each Room
+    int32_t *queue;      // Rooms whose distance is known, nearest first
+
+    int32_t *adj;        // a Room's slice of adjList[]
+
+    inStart = (int32_t *) calloc(world->numRooms + 1, sizeof(int32_t));
+    inList = (int32_t *) malloc(sizeof(int32_t) *
+                                (world->numAdj > 0 ? world->numAdj : 1));
+    queue = (int32_t *) malloc(sizeof(int32_t) * world->numRooms);
+    if(inStart == NULL || inList == NULL || queue == NULL) {
+        free(inStart);
+        free(inList);
+        free(queue);
+        return 1;
+    }
+
+    // Connections are usually two-way, but nothing in a Room file says
+    // they have to be, so turn adjList[] around: count the connections
+    // into each Room, add the counts up into starting offsets, then
+    // place each connection (leaving each inStart[] at the end of its
+    // slice, which is where the next slice starts).
+    //
+    for(i = 0; i < world->numRooms; i++) {
+        adj = world->adjList + world->rooms[i].adjStart;
+        for(x = 0; x < world->rooms[i].adjCount; x++) {
+            inStart[adj[x] + 1]++;
+        }
+    }
+    for(i = 0; i < world->numRooms; i++) {
+        inStart[i + 1] += inStart[i];
+    }
+    for(i = 0; i < world->numRooms; i++) {
+        adj = world->adjList + world->rooms[i].adjStart;
+        for(x = 0; x < world->rooms[i].adjCount; x++) {
+            inList[inStart[adj[x]]++] = i;
+        }
+    }
+    for(i = world->numRooms; i > 0; i--) {
+        inStart[i] = inStart[i - 1];
+    }
+    inStart[0] = 0;
+
+    // Every END ROOM is 0 steps away. Each Room taken off the queue is
+    // one step further for every Room that connects into it and has
+    // not been reached yet.
+    //
+    for(i = 0; i < world->numRooms; i++) {
+        world->rooms[i].endDist = NO_DISTANCE;
+        if(world->rooms[i].type == END_ROOM) {
+            world->rooms[i].endDist = 0;
+            queue[tail++] = i;
+        }
+    }
+    while(head < tail) {
+        room = queue[head++];
+        for(x = inStart[room]; x < inStart[room + 1]; x++) {
+            from = inList[x];
+            if(world->rooms[from].endDist == NO_DISTANCE) {
+                world->rooms[from].endDist = world->rooms[room].endDist + 1;
+                queue[tail++] = from;
+            }
+        }
+    }
+
+    free(inStart);
+    free(inList);
+    free(queue);
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// bestMove(struct World *world, int currRoom)
+//
+// Purpose: Find the adjacent Room on a shortest path to the END ROOM.
+//
+// *****************************************************************************
+//
+int bestMove(struct World *world, int currRoom) {
+
+    int x;               // loop iterator
+    int room;            // an adjacent Room
+    int best = -1;       // closest adjacent Room so far
+
+    int32_t *adj;        // the current Room's slice of adjList[]
+
+    struct Room *curr = &world->rooms[currRoom];
+
+    // The first adjacent Room with the smallest known distance wins. A
+    // lazily loaded World has to read the adjacent Rooms to know their
+    // distances, but the prefetcher has usually done that already.
+    // Loading them may grow adjList[], but the copy read here is kept
+    // until the World is freed.
+    //
+    adj = __atomic_load_n(&world->adjList, __ATOMIC_ACQUIRE) + curr->adjStart;
+    for(x = 0; x < curr->adjCount; x++) {
+        room = adj[x];
+        loadRoom(world, room);
+        if(world->rooms[room].endDist >= 0 &&
+           (best < 0 ||
+            world->rooms[room].endDist < world->rooms[best].endDist)) {
+            best = room;
+        }
+    }
+
+    return best;
+
+}
+
+
+// *****************************************************************************
+// 
+// cleanRooms(struct World *world)
+//
+// Free all memory used by the World's Rooms.
+//
+// *****************************************************************************
+//
+void cleanRooms(struct World *world) {
+
+    // Stop lazy loading first, so nothing is read into the World while
+    // it is being freed.
+    //
+    if(world->lazy != NULL) {
+        stopLazy(world);
+    }
+
+    // A mapped World is released all at once, and so is the Arena that
+    // holds everything else. Only a World that was never finished has
+    // separate allocations to free. Set the pointers to NULL afterward
+    // to finish them off properly.
+    //
+    if(world->map != NULL) {
+        munmap(world->map, world->mapSize);
+    }
+    if(world->arena.base != NULL) {
+        arenaFree(&world->arena);
+    } else {
+        if(world->map == NULL) {
+            free(world->rooms);
+            free(world->adjList);
+            free(world->names);
+        }
+        free(world->nameIndex);
+    }
+    world->nameIndex = NULL;
+    world->indexSize = 0;
+    world->adjBits = NULL;
+    world->bitWords = 0;
+    world->rooms = NULL;
+    world->adjList = NULL;
+    world->names = NULL;
+    world->map = NULL;
+    world->mapSize = 0;
+    world->numAdj = 0;
+    world->namesSize = 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// compareInts(const void *a, const void *b)
+//
+// Purpose: qsort() comparison function for int32_t arrays.
+//
+// *****************************************************************************
+//
+static int compareInts(const void *a, const void *b) {
+
+    int32_t x = *(const int32_t *) a;
+    int32_t y = *(const int32_t *) b;
+
+    return (x > y) - (x < y);
+
+}
+
+
+// *****************************************************************************
+// 
+// buildAdjacency(struct World *world, int edgeFrom[], int edgeTo[],
+//                int numEdges)
+//
+// Purpose: Pack the connections into the World's adjList[].
+//
+// *****************************************************************************
+//
+int buildAdjacency(struct World *world, int edgeFrom[], int edgeTo[],
+                   int numEdges) {
+
+    int i, x;            // loop iterators
+    int pos;             // next free slot when packing adjList[]
+    int start;           // original start of a Room's slice
+
+    struct Room *rooms = world->rooms;
+
+    // Every connection is two-way, so it shows up in the slices of both
+    // of its Rooms.
+    //
+    world->adjList = (int32_t *) malloc(sizeof(int32_t) * (numEdges * 2 + 1));
+    if(world->adjList == NULL) {
+        return 1;
+    }
+
+    // Count the connections of each Room...
+    //
+    for(i = 0; i < world->numRooms; i++) {
+        rooms[i].adjCount = 0;
+    }
+    for(i = 0; i < numEdges; i++) {
+        rooms[edgeFrom[i]].adjCount++;
+        rooms[edgeTo[i]].adjCount++;
+    }
+
+    // ...then carve adjList[] into one slice per Room...
+    //
+    pos = 0;
+    for(i = 0; i < world->numRooms; i++) {
+        rooms[i].adjStart = pos;
+        pos += rooms[i].adjCount;
+        rooms[i].adjCount = 0;
+    }
+
+    // ...and drop each connection into the slices of both its Rooms.
+    //
+    for(i = 0; i < numEdges; i++) {
+        struct Room *from = &rooms[edgeFrom[i]];
+        struct Room *to = &rooms[edgeTo[i]];
+
+        world->adjList[from->adjStart + from->adjCount++] = edgeTo[i];
+        world->adjList[to->adjStart + to->adjCount++] = edgeFrom[i];
+    }
+
+    // The same connection may have been picked more than once. Sort each
+    // slice and squeeze out the repeats, sliding the slices down so
+    // adjList[] stays packed. A slice never moves past its original
+    // start, so this can be done in place.
+    //
+    pos = 0;
+    for(i = 0; i < world->numRooms; i++) {
+        start = rooms[i].adjStart;
+        qsort(&world->adjList[start], rooms[i].adjCount, sizeof(int32_t),
+              compareInts);
+
+        rooms[i].adjStart = pos;
+        for(x = 0; x < rooms[i].adjCount; x++) {
+            if(pos == rooms[i].adjStart ||
+               world->adjList[pos - 1] != world->adjList[start + x]) {
+                world->adjList[pos++] = world->adjList[start + x];
+            }
+        }
+        rooms[i].adjCount = pos - rooms[i].adjStart;
+    }
+    world->numAdj = pos;
+
+    return 0;
+
+}
+
+
+// struct Linker: Scratch state used by connectRooms() while it builds
+// the connections.
+//
+// nbr[]      -> maxDegree slots per Room holding the Rooms it is
+//               connected to so far.
+//
+// deg[]      -> Number of connections each Room has so far.
+//
+// open[]     -> Rooms that can still take another connection (deg[] below
+//               maxDegree), in no particular order.
+//
+// openPos[]  -> Where each Room sits in open[], or -1 if it is not there.
+//
+struct Linker {
+    int maxDegree;
+    int *nbr;
+    int *deg;
+    int *open;
+    int *openPos;
+    int numOpen;
+};
+
+
+// *****************************************************************************
+// 
+// linkRooms(struct Linker *lk, int a, int b)
+//
+// Purpose: Connect Rooms a and b, taking any Room that is now full out
+//          of open[] (by moving the last open Room into its place).
+//
+// *****************************************************************************
+//
+static void linkRooms(struct Linker *lk, int a, int b) {
+
+    int ends[2];         // the two Rooms being connected
+    int i;               // loop iterator
+    int r;               // Room being updated
+    int last;            // Room at the end of open[]
+
+    lk->nbr[(size_t) a * lk->maxDegree + lk->deg[a]++] = b;
+    lk->nbr[(size_t) b * lk->maxDegree + lk->deg[b]++] = a;
+
+    ends[0] = a;
+    ends[1] = b;
+    for(i = 0; i < 2; i++) {
+        r = ends[i];
+        if(lk->deg[r] == lk->maxDegree && lk->openPos[r] >= 0) {
+            last = lk->open[--lk->numOpen];
+            lk->open[lk->openPos[r]] = last;
+            lk->openPos[last] = lk->openPos[r];
+            lk->openPos[r] = -1;
+        }
+    }
+
+}
+
+
+// *****************************************************************************
+// 
+// linked(struct Linker *lk, int a, int b)
+//
+// Purpose: Tell whether Rooms a and b are already connected. A Room has at
+//          most maxDegree connections, so this is a short scan.
+//
+// *****************************************************************************
+//
+static int linked(struct Linker *lk, int a, int b) {
+
+    int i;               // loop iterator
+
+    for(i = 0; i < lk->deg[a]; i++) {
+        if(lk->nbr[(size_t) a * lk->maxDegree + i] == b) {
+            return 1;
+        }
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// findSet(int parent[], int x)
+//
+// Purpose: Union-find lookup with path halving. Returns the Room that
+//          stands for x's group of connected Rooms.
+//
+// *****************************************************************************
+//
+static int findSet(int parent[], int x) {
+
+    while(parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+    }
+
+    return x;
+
+}
+
+
+// *****************************************************************************
+// 
+// connectRooms(struct World *world, struct GenParams *params,
+//              struct Rng *rng)
+//
+// Purpose: Connect the Rooms into one connected, degree-bounded World.
+//
+// *****************************************************************************
+//
+int connectRooms(struct World *world, struct GenParams *params,
+                 struct Rng *rng) {
+
+    int i, x;            // loop iterators
+    int numRooms;        // number of Rooms in the World
+    int minDegree;       // fewest connections per Room
+    int room;            // Room being connected
+    int partner;         // Room it gets connected to
+    int swap;            // holds a Room while shuffling
+    int numEdges;        // number of connections made
+    int groups;          // number of separate groups of Rooms
+    int a, b;            // union-find representatives
+    int *order = NULL;   // Rooms in the order they join the tree
+    int *parent = NULL;  // union-find parent of each Room
+    int *edgeFrom = NULL; // one end of each connection
+    int *edgeTo = NULL;  // other end of each connection
+    int result;          // what buildAdjacency() returned
+
+    struct Linker lk;    // connections made so far
+
+    numRooms = world->numRooms;
+    if(numRooms < MIN_ROOMS) {
+        printf("Too few Rooms to connect: %d\n", numRooms);
+        return 1;
+    }
+
+    // A Room can't be connected to more Rooms than there are.
+    //
+    lk.maxDegree = params->maxDegree;
+    if(lk.maxDegree > numRooms - 1) {
+        lk.maxDegree = numRooms - 1;
+    }
+    minDegree = params->minDegree;
+    if(minDegree > lk.maxDegree) {
+        minDegree = lk.maxDegree;
+    }
+
+    lk.nbr = (int *) malloc(sizeof(int) * numRooms * lk.maxDegree);
+    lk.deg = (int *) calloc(numRooms, sizeof(int));
+    lk.open = (int *) malloc(sizeof(int) * numRooms);
+    lk.openPos = (int *) malloc(sizeof(int) * numRooms);
+    order = (int *) malloc(sizeof(int) * numRooms);
+    if(lk.nbr == NULL || lk.deg == NULL || lk.open == NULL ||
+       lk.openPos == NULL || order == NULL) {
+        printf("Error allocating connections for %d Rooms\n", numRooms);
+        return 1;
+    }
+    lk.numOpen = 0;
+
+    // Shuffle the Rooms (Fisher-Yates) to get the order in which they
+    // join the tree.
+    //
+    for(i = 0; i < numRooms; i++) {
+        order[i] = i;
+        lk.openPos[i] = -1;
+    }
+    for(i = numRooms - 1; i > 0; i--) {
+        x = rngBounded(rng, i + 1);
+        swap = order[i];
+        order[i] = order[x];
+        order[x] = swap;
+    }
+
+    //
+    // *******************************************************************
+    // Random spanning tree. Each Room in turn connects to a random Room
+    // already in the tree that still has space for another connection.
+    // Every Room added has only the one connection, so with maxDegree of
+    // at least 2 there is always somewhere to connect the next one.
+    // *******************************************************************
+    //
+
+    lk.open[0] = order[0];
+    lk.openPos[order[0]] = 0;
+    lk.numOpen = 1;
+
+    for(i = 1; i < numRooms; i++) {
+        room = order[i];
+        partner = lk.open[rngBounded(rng, lk.numOpen)];
+
+        lk.open[lk.numOpen] = room;
+        lk.openPos[room] = lk.numOpen++;
+        linkRooms(&lk, room, partner);
+    }
+
+    //
+    // *******************************************************************
+    // Extra connections. Any Room still short of minDegree connects to
+    // random Rooms that have space left and are not already connected to
+    // it. A few random tries almost always find one; if not, walk open[]
+    // looking for any partner that will do.
+    // *******************************************************************
+    //
+
+    for(i = 0; i < numRooms; i++) {
+        room = order[i];
+        while(lk.deg[room] < minDegree) {
+            partner = -1;
+            for(x = 0; x < PARTNER_TRIES && partner < 0; x++) {
+                partner = lk.open[rngBounded(rng, lk.numOpen)];
+                if(partner == room || linked(&lk, room, partner)) {
+                    partner = -1;
+                }
+            }
+            for(x = 0; x < lk.numOpen && partner < 0; x++) {
+                partner = lk.open[x];
+                if(partner == room || linked(&lk, room, partner)) {
+                    partner = -1;
+                }
+            }
+
+            // Nobody left to connect to. Only happens in tiny Worlds
+            // where the bounds can't all be met.
+            //
+            if(partner < 0) {
+                break;
+            }
+
+            linkRooms(&lk, room, partner);
+        }
+    }
+
+    // Gather the connections, each one once, for buildAdjacency().
+    //
+    numEdges = 0;
+    for(i = 0; i < numRooms; i++) {
+        numEdges += lk.deg[i];
+    }
+    numEdges /= 2;
+
+    edgeFrom = (int *) malloc(sizeof(int) * (numEdges + 1));
+    edgeTo = (int *) malloc(sizeof(int) * (numEdges + 1));
+    parent = order;     // the tree order is no longer needed
+    if(edgeFrom == NULL || edgeTo == NULL) {
+        printf("Error allocating %d connections\n", numEdges);
+        return 1;
+    }
+
+    numEdges = 0;
+    for(i = 0; i < numRooms; i++) {
+        for(x = 0; x < lk.deg[i]; x++) {
+            if(lk.nbr[(size_t) i * lk.maxDegree + x] > i) {
+                edgeFrom[numEdges] = i;
+                edgeTo[numEdges] = lk.nbr[(size_t) i * lk.maxDegree + x];
+                numEdges++;
+            }
+        }
+    }
+
+    // Double check with union-find that the connections really do tie
+    // every Room into one group: start with each Room in a group of its
+    // own and merge the groups at both ends of every connection.
+    //
+    for(i = 0; i < numRooms; i++) {
+        parent[i] = i;
+    }
+    groups = numRooms;
+    for(i = 0; i < numEdges; i++) {
+        a = findSet(parent, edgeFrom[i]);
+        b = findSet(parent, edgeTo[i]);
+        if(a != b) {
+            parent[a] = b;
+            groups--;
+        }
+    }
+
+    free(lk.nbr);
+    free(lk.deg);
+    free(lk.open);
+    free(lk.openPos);
+    free(order);
+
+    if(groups != 1) {
+        printf("Error connecting Rooms: %d separate groups\n", groups);
+        free(edgeFrom);
+        free(edgeTo);
+        return 1;
+    }
+
+    result = buildAdjacency(world, edgeFrom, edgeTo, numEdges);
+    if(result != 0) {
+        printf("Error allocating %d connections\n", numEdges * 2);
+    }
+
+    free(edgeFrom);
+    free(edgeTo);
+
+    return result;
+
+}
+
+
+// *****************************************************************************
+// 
+// shardOf(const char *name, int numShards)
+//
+// Purpose: Pick a Room file's subdirectory from a hash of its name.
+//
+// *****************************************************************************
+//
+int shardOf(const char *name, int numShards) {
+
+    return (int) (hashName(name, strlen(name)) % (uint32_t) numShards);
+
+}
+
+
+// *****************************************************************************
+// 
+// nameIndexSlots(int numRooms)
+//
+// Purpose: Work out how many nameIndex[] slots a World needs. The table
+//          is kept at most half full so probe sequences stay short.
+//
+// *****************************************************************************
+//
+int nameIndexSlots(int numRooms) {
+
+    int slots = 16;      // a power of 2, at least twice numRooms
+
+    while(slots < numRooms * 2) {
+        slots *= 2;
+    }
+
+    return slots;
+
+}
+
+
+// *****************************************************************************
+// 
+// adjBitsWords(int numRooms)
+//
+// Purpose: Work out how many words a row of adjBits[] takes.
+//
+// *****************************************************************************
+//
+int adjBitsWords(int numRooms) {
+
+    if(numRooms > BITSET_ROOMS) {
+        return 0;
+    }
+
+    // Whole bitVecs of 256 bits each.
+    //
+    return (numRooms + 255) / 256 * 4;
+
+}
+
+
+// *****************************************************************************
+// 
+// buildAdjBits(struct World *world)
+//
+// Purpose: Build the adjacency bitset of a small World.
+//
+// *****************************************************************************
+//
+int buildAdjBits(struct World *world) {
+
+    int i, x;            // loop iterators
+    int room;            // an adjacent Room
+
+    uint64_t *row;       // the bits of Room i
+
+    world->bitWords = adjBitsWords(world->numRooms);
+    world->adjBits = NULL;
+    if(world->bitWords == 0) {
+        return 0;
+    }
+
+    world->adjBits = (uint64_t *) arenaAlloc(&world->arena, sizeof(uint64_t) *
+                                             world->bitWords * world->numRooms);
+    if(world->adjBits == NULL) {
+        world->bitWords = 0;
+        return 1;
+    }
+    memset(world->adjBits, 0,
+           sizeof(uint64_t) * world->bitWords * world->numRooms);
+
+    for(i = 0; i < world->numRooms; i++) {
+        row = world->adjBits + (size_t) i * world->bitWords;
+        for(x = 0; x < world->rooms[i].adjCount; x++) {
+            room = world->adjList[world->rooms[i].adjStart + x];
+            row[room >> 6] |= 1ULL << (room & 63);
+        }
+    }
+
+    return 0;
+
+}
+
+
+// *****************************************************************************
+// 
+// buildNameIndex(struct World *world)
+//
+// Purpose: Build the hash table that findRoom() uses.
+//
+// *****************************************************************************
+//
+int buildNameIndex(struct World *world) {
+
+    int i;               // loop iterator
+    uint32_t slot;       // nameIndex[] slot being probed
+    uint32_t mask;       // indexSize - 1, turns a hash into a slot
+    uint32_t hash;       // hash of the Room's name
+
+    char *name;          // name of the Room being indexed
+
+    world->indexSize = nameIndexSlots(world->numRooms);
+    mask = world->indexSize - 1;
+
+    if(world->arena.base != NULL) {
+        world->nameIndex = (struct NameSlot *) arenaAlloc(&world->arena,
+                               sizeof(struct NameSlot) * world->indexSize);
+    } else {
+        world->nameIndex = (struct NameSlot *) malloc(
+                               sizeof(struct NameSlot) * world->indexSize);
+    }
+    if(world->nameIndex == NULL) {
+        world->indexSize = 0;
+        return 1;
+    }
+    memset(world->nameIndex, 0xff,
+           sizeof(struct NameSlot) * world->indexSize);
 
-    // Clean up Room struct pointers.
+    // Drop each Room into the first free slot at or after its hash
+    // (linear probing).
     //
-    cleanRooms(prooms);
+    for(i = 0; i < world->numRooms; i++) {
+        name = roomName(world, i);
+        hash = hashName(name, strlen(name));
+        slot = hash & mask;
+        while(world->nameIndex[slot].room >= 0) {
+            slot = (slot + 1) & mask;
+        }
+        world->nameIndex[slot].room = i;
+        world->nameIndex[slot].hash = hash;
+    }
 
     return 0;
 
@@ -204,552 +8141,428 @@ int main() {
 
 // *****************************************************************************
 // 
-// setupRooms(struct Room *prooms[], char dirName[], char *roomNames[])
+// packWorld(struct World *world)
 //
-// Purpose: Create Rooms and output the data to files.
+// Purpose: Move a built World into one exactly sized Arena.
 //
 // *****************************************************************************
 //
-int setupRooms(struct Room *prooms[], char dirName[], char *roomNames[]) {
+int packWorld(struct World *world) {
 
-    int i, x;                    // loop iterators
-    int seed;                    // srand seed
-    int num;                     // holds number generated by rand()
-    int roomNamesUsed[10] = {0}; // when a name is used, mark it as unavailable
-    int adjCount;                // number of adjacent Rooms so far
+    size_t roomsBytes;   // size of rooms[]
+    size_t adjBytes;     // size of adjList[]
+    size_t namesBytes;   // size of names[]
+    size_t indexBytes;   // size of nameIndex[] (0 if there is none yet)
+    size_t bitsBytes;    // size of adjBits[] (0 if the World is too big)
 
-    FILE *fp = NULL;             // output file pointer
+    struct World packed = *world; // the World, pointing into the Arena
 
-    char fullPathName[50];       // holds the full path to a Room file
+    roomsBytes = sizeof(struct Room) * world->numRooms;
+    adjBytes = sizeof(int32_t) * world->numAdj;
+    namesBytes = world->namesSize;
+    indexBytes = (world->nameIndex != NULL ?
+                  sizeof(struct NameSlot) * world->indexSize :
+                  sizeof(struct NameSlot) * nameIndexSlots(world->numRooms));
+    bitsBytes = sizeof(uint64_t) * adjBitsWords(world->numRooms) *
+                world->numRooms;
 
-    // Seed the random number generator
+    // Every piece is rounded up to 8 bytes by arenaAlloc(), so leave
+    // room for that. Space for the name index is always set aside, so
+    // buildNameIndex() can be run on the packed World later.
     //
-    seed = time(NULL);
-    srand(seed);
+    if(arenaInit(&packed.arena, roomsBytes + adjBytes + namesBytes +
+                 indexBytes + bitsBytes + 5 * 8) != 0) {
+        return 1;
+    }
 
+    // Rooms first, in index order, then the adjacency slices in the same
+    // order, so walking from a Room to its neighbours stays close by.
     //
-    // *******************************************************************
-    // Set up the array of Room structs. Initially, all adjacent rooms are
-    // set to 0 and all room types are set to MID_ROOM for simplicity.
-    // *******************************************************************
-    //
-
-    for(i = 0; i < MAX_ROOMS; i++) {
-        // Generate a random index number for the Room's name, making sure
-        // to not reuse a name that has already been allocated. This index
-        // will read a name from the roomNames[] array and assign it to
-        // the Room.
-        //
-        do {
-            num = (rand() % (10));
-        } while(roomNamesUsed[num] == 1);
-
-        // Create a new Room struct.
-        //
-        struct Room *newRoom = (struct Room *) malloc(sizeof(struct Room));
-
-        // Copy Room name to room
-        //
-        strcpy(newRoom->name, roomNames[num]);
-
-        // Mark the name as taken so it won't be reused.
-        //
-        roomNamesUsed[num] = 1;
-
-        // Initialize the adjacent rooms to 0.
-        //
-        for(x = 0; x < MAX_ROOMS; x++) {
-            newRoom->adj[x] = 0;
-        }
-
-        // Start off with all rooms set to type MID_ROOM.
-        //
-        newRoom->type = MID_ROOM;
-
-        // Add newRoom to the prooms[] array.
-        //
-        prooms[i] = newRoom;
+    packed.rooms = (struct Room *) arenaAlloc(&packed.arena, roomsBytes);
+    memcpy(packed.rooms, world->rooms, roomsBytes);
+    packed.adjList = (int32_t *) arenaAlloc(&packed.arena, adjBytes);
+    memcpy(packed.adjList, world->adjList, adjBytes);
+    packed.names = (char *) arenaAlloc(&packed.arena, namesBytes);
+    memcpy(packed.names, world->names, namesBytes);
+    if(world->nameIndex != NULL) {
+        packed.nameIndex = (struct NameSlot *) arenaAlloc(&packed.arena,
+                                                          indexBytes);
+        memcpy(packed.nameIndex, world->nameIndex, indexBytes);
     }
 
-    // Determine START and END rooms. All Rooms are currently set to
-    // MID_ROOM so just pick one random Room each for the START and END.
-    //
-    num = (rand() % (MAX_ROOMS));
-    prooms[num]->type = START_ROOM;
-    do {
-        num = (rand() % (MAX_ROOMS));
-    } while(prooms[num]->type == START_ROOM);
-    prooms[num]->type = END_ROOM;
- 
+    free(world->rooms);
+    free(world->adjList);
+    free(world->names);
+    free(world->nameIndex);
+    *world = packed;
 
-    // Assign adjacent Rooms. An array, adj[], holds the values that flag
-    // a room as being adjacent. The indices are arranged in the order in
-    // which the Room structs are positioned in prooms[]: if a Room is
-    // adjacent, a 1 is entered into its index in adj[], otherwise the
-    // index contains a 0 (not adjacent).
+    // The bitset goes last; it is only read a row at a time.
     //
-    for(i = 0; i < MAX_ROOMS; i++) {
+    return buildAdjBits(world);
 
-        adjCount = 0; // Holds the number of adjacent Rooms assigned
+}
 
-        // Assign a minimum of 3 adjacent Rooms for each Room. When adding
-        // an adjacent Room, be sure to update the adjacent Room's adj[]
-        // array to reflect the two-way connection. By doing this, it's
-        // possible that a maximum of MAX_ROOMS-1 Rooms can be adjacent.
-        //
-        // Be sure to not assign a Room as being adjacent to itself!
-        //
-        while(adjCount < 3) {
-            // Keep calculating random numbers until the number doesn't match
-            // the current Room number.
-            //
-            do {
-                num = (rand() % (MAX_ROOMS));
-            } while(num == i);
 
-            // Assign 1 to each side of the Room connection.
-            //
-            prooms[i]->adj[num] = 1;
-            prooms[num]->adj[i] = 1;
+// *****************************************************************************
+// 
+// arenaInit(struct Arena *arena, size_t size)
+//
+// Purpose: Allocate an Arena's block.
+//
+// *****************************************************************************
+//
+int arenaInit(struct Arena *arena, size_t size) {
 
-            adjCount++;
-        }
+    arena->base = (char *) malloc(size > 0 ? size : 1);
+    arena->size = size;
+    arena->used = 0;
 
-    }
+    return (arena->base == NULL ? 1 : 0);
 
-    // For each Room, write one Room file to the output directory.
-    //
-    for(i = 0; i < MAX_ROOMS; i++) {
+}
 
-        // Build the full path name for the Room file.
-        //
-        sprintf(fullPathName, "%s/%s", dirName, prooms[i]->name);
 
-        // Open the file for writing.
-        //
-        fp = fopen(fullPathName, "w");
+// *****************************************************************************
+// 
+// arenaAlloc(struct Arena *arena, size_t size)
+//
+// Purpose: Hand out the next piece of an Arena.
+//
+// *****************************************************************************
+//
+void *arenaAlloc(struct Arena *arena, size_t size) {
 
-        // If there was a problem, exit with an error.
-        //
-        if(fp == NULL) {
-            printf("Error opening %s: errno = %d\n", fullPathName, errno);
-            exit(1);
-        }
+    void *piece;         // the memory handed out
 
-        // Write the Room name to the file.
-        //
-        fprintf(fp, "ROOM NAME: %s\n", prooms[i]->name);
+    // Round up so the next piece stays 8 byte aligned.
+    //
+    size = (size + 7) & ~((size_t) 7);
+    if(arena->used + size > arena->size) {
+        return NULL;
+    }
 
-        // Write the adjacent Rooms ("CONNECTIONS") to the file. Be sure
-        // to add a count to each of the lines:
-        //
-        //    CONNECTION 1: Roomname
-        //    CONNECTION 2: Roomname
-        //    ...
-        //
-        adjCount = 0;
-        for(x = 0; x < MAX_ROOMS; x++) {
-            if(prooms[i]->adj[x] == 1) {
-                fprintf(fp, "CONNECTION %d: %s\n", ++adjCount, prooms[x]->name);
-            }
-        }
+    piece = arena->base + arena->used;
+    arena->used += size;
 
-        // Write the Room type to the file.
-        //
-        fprintf(fp, "ROOM TYPE: ");
-        if(prooms[i]->type == START_ROOM) {
-            fprintf(fp, "START_ROOM");
-        } else if(prooms[i]->type == MID_ROOM) {
-            fprintf(fp, "MID_ROOM");
-        } else {
-            fprintf(fp, "END_ROOM");
-        }
+    return piece;
 
-        // To make things pretty when typing to the screen, add a
-        // newline to the end of the Room file.
-        //
-        fprintf(fp, "\n");
+}
 
-        // Close the Room file.
-        //
-        fclose(fp);
-    }
 
-    // Delete all pointers from the prooms[] Room array
-    //
-    cleanRooms(prooms);
+// *****************************************************************************
+// 
+// arenaFree(struct Arena *arena)
+//
+// Purpose: Free everything handed out from an Arena in one go.
+//
+// *****************************************************************************
+//
+void arenaFree(struct Arena *arena) {
 
-    return 0;
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
 
 }
 
 
 // *****************************************************************************
 // 
-// readRooms(struct Room *prooms[], char dirName[], char *readRoomNames[])
+// findRoom(struct World *world, char name[])
 //
-// Purpose: Read Room data in from files.
+// Purpose: Look up a Room by name.
 //
 // *****************************************************************************
 //
-int readRooms(struct Room *prooms[], char dirName[], char *readRoomNames[]) {
+int findRoom(struct World *world, char name[]) {
 
-    int i, x;                 // loop iterators
-    int roomCount;            // number of Room files read so far
+    return findRoomLen(world, name, strlen(name));
 
-    FILE *fp = NULL;          // file pointer
-    DIR  *dp = NULL;          // directory pointer
-    struct dirent *dirFiles;  // struct that holds directory data
+}
 
-    char fullPathName[50];    // holds the full path to a room file
 
-    struct stat filestat;     // stat() information on a directory entity
+// *****************************************************************************
+// 
+// findRoomLen(struct World *world, const char *name, int len)
+//
+// Purpose: Look up a Room by a name that is not null terminated.
+//
+// *****************************************************************************
+//
+int findRoomLen(struct World *world, const char *name, int len) {
 
-    // Fields used by fscanf() to read data from lines in the Room files.
-    // All files have three fields per line. If any more fields are added,
-    // another field# array needs to be added for each new field.
-    //
-    char field1[MAX_ROOM_CHARS];
-    char field2[MAX_ROOM_CHARS];
-    char field3[MAX_ROOM_CHARS];
+    uint32_t slot;       // nameIndex[] slot being probed
+    uint32_t mask;       // indexSize - 1, turns a hash into a slot
+    uint32_t hash;       // hash of the name
 
-    // Open the output file directory.
-    //
-    dp = opendir(dirName);
+    char *candidate;     // name of the Room in the slot being probed
 
-    // If there was a problem opening the output file directory, exit with
-    // an error.
+    // Follow the probe sequence from the name's hash until the name
+    // turns up or an empty slot shows it is not there. Only a slot with
+    // the same hash is worth comparing the name with, and a match has to
+    // end where the slice ends, so "Bach1" does not match "Bach12".
     //
-    if(dp == NULL) {
-        printf("Error opening %s: errno = %d\n", dirName, errno);
-        exit(1);
+    mask = world->indexSize - 1;
+    hash = hashName(name, len);
+    slot = hash & mask;
+    while(world->nameIndex[slot].room >= 0) {
+        if(world->nameIndex[slot].hash == hash) {
+            candidate = roomName(world, world->nameIndex[slot].room);
+            if(strncmp(candidate, name, len) == 0 && candidate[len] == '\0') {
+                return world->nameIndex[slot].room;
+            }
+        }
+        slot = (slot + 1) & mask;
     }
 
-    //
-    // *******************************************************************
-    // Fill the readRoomNames array with filenames from the directory.
-    // We need to do this to have an indexable list of rooms for
-    // navigation.
-    // *******************************************************************
-    //
-    
-    // Start with no Rooms read.
-    //
-    roomCount = 0;
-
-    // Read Room files from the output directory.
-    //
-    while(((dirFiles = readdir(dp)) != NULL) && (roomCount < MAX_ROOMS)) {
+    return -1;
 
-        // Each time readdir() runs, another entity is read from the
-        // output directory. If the file is a regular file and not ".",
-        // ".." add it to the array that holds room names. 
-        //
-        // I'm trying to be POSIX compliant here by not using DT_REG to
-        // check the regular-ness of the file. Supposedly the S_ISREG()
-        // macro is more portable.
-        //
-        sprintf(fullPathName, "%s/%s", dirName, dirFiles->d_name);
-        stat(fullPathName, &filestat);
-        if(S_ISREG(filestat.st_mode) != 0) {
-            readRoomNames[roomCount] = dirFiles->d_name;
-            roomCount++;
-        }
-    }
+}
 
-    //
-    // The readRoomNames[] array has been populated. We now have a new
-    // ordering for the rooms in readRoomNames[] (based on the order in
-    // which they were read in from the output directory) so the adjacent
-    // room mapping will need to be indexed based on the position of Room
-    // names in readRoomNames[].
-    //
 
-    // For each file, open the file and read its contents.
-    //
-    for(i = 0; i < MAX_ROOMS; i++) {
-
-       // Build the full path to the Room file.
-       //
-       sprintf(fullPathName, "%s/%s", dirName, readRoomNames[i]);
-
-       // Open the Room file.
-       //
-       fp = fopen(fullPathName, "r");
-
-       // If there was a problem opening the Room file, exit with an
-       // error.
-       //
-       if(fp == NULL) {
-           printf("Error opening %s: errno = %d\n", fullPathName, errno);
-           exit(1);
-       }
-
-       // Create a new Room struct to hold Room data read in from the file
-       // in the output directory.
-       //
-       struct Room *newRoom = (struct Room *) malloc(sizeof(struct Room));
-
-       // Initialize all adjacent rooms in adj[] to 0 for simplicity.
-       //
-       for(x = 0; x < MAX_ROOMS; x++) {
-           newRoom->adj[x] = 0;
-       }
-
-       //
-       // Start reading in lines from the Room file. For each line, read
-       // the three distinct fields into the three field arrays (field1[],
-       // field2[], field3[]) and parse data from the fields according to
-       // their positions.
-       //
-       
-       // Read lines from the Room file until EOF.
-       //
-       while(fscanf(fp, "%s %s %s", field1, field2, field3) != EOF) {
-
-           // If the first field contains "ROOM", move to the second field
-           //
-           if(strcmp(field1, "ROOM") >= 0) {
-               // If the second field contains "NAME", field3 is the
-               // Room name. If not, it's the Room type.
-               // 
-               if(strncmp(field2, "NAME", 4) == 0) {
-                   strcpy(newRoom->name, field3);
-               } else if(strncmp(field2, "TYPE", 4) == 0) {
-                   if(strncmp(field3, "START_ROOM", 10) == 0) {
-                       newRoom->type = START_ROOM;
-                   } else if(strncmp(field3, "MID_ROOM", 8) == 0) {
-                       newRoom->type = MID_ROOM;
-                   } else if(strncmp(field3, "END_ROOM", 8) == 0) {
-                       newRoom->type = END_ROOM;
-                   }
-               }
-           } else if (strncmp(field1, "CONNECTION", 10) == 0) {
-               // For each "CONNECTION", compare field3 (the adjacent Room
-               // name) to the readRoomNames[] array and, if you get a
-               // match, flag the identical index in adj[] to mark the
-               // room as adjacent. 
-               //
-               // Do not mark the current Room as adjacent in the adjacent
-               // room's adj[] array!  That was only necessary when
-               // setting up the Room files in setupRooms().
-               //
-               for(x = 0; x < MAX_ROOMS; x++) {
-                   if(strcmp(field3, readRoomNames[x]) == 0) {
-                       newRoom->adj[x] = 1;
-                   }
-               }
-           }
-
-           // Add the new Room struct to the prooms[] Room array.
-           //
-           prooms[i] = newRoom;
-       }
-    
-       // Close the file.
-       //
-       fclose(fp);
-
-    }
-
-    // Close the output directory.
-    //
-    closedir(dp);
+// *****************************************************************************
+// 
+// roomName(struct World *world, int room)
+//
+// Purpose: Look up a Room's name in the World's string table.
+//
+// *****************************************************************************
+//
+char *roomName(struct World *world, int room) {
 
-    return 0;
+    return world->names + world->rooms[room].nameOff;
 
 }
 
 
 // *****************************************************************************
 // 
-// playGame(struct Room *prooms[], char *readRoomNames[])
+// splitMix64(uint64_t *x)
 //
-// Purpose: Perform the actual game functionality.
+// Purpose: SplitMix64 generator. Only used to turn a seed into the 256
+//          bits of xoshiro256** state, as its authors recommend.
 //
 // *****************************************************************************
 //
-int playGame(struct Room *prooms[], char *readRoomNames[]) {
+static uint64_t splitMix64(uint64_t *x) {
 
-    // struct Path: Holds the rooms visited on the "path" to the END ROOM
-    //
-    // pathIDXs[]  -> Indices of readRoomNames[] that map to rooms visited
-    //                along the path.
-    //
-    // pathCount   -> Tracks how many Rooms were added to the Path
-    //
-    struct Path {
-        int pathIdxs[MAX_PATH];
-        int pathCount;
-    };
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
 
-    int i, x;            // loop iterators
-    int conn;            // tracks which "CONNECTION" is being processed.
-                         //   Used to control display of commas in output.
-    int userInputLen;    // holds length of user input. Used to get rid of 
-                         //   trailing newline.
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
 
-    char userInput[MAX_ROOM_CHARS]; // holds string entered by user
+    return z ^ (z >> 31);
 
-    // Initialize to -1 because 0 is a legitimate value.
-    //
-    int userInputIdx = -1;
+}
 
-    // Set up a new Room struct to always point to the current Room.
-    //
-    struct Room *currRoom = NULL;
 
-    // Set up a new Path struct to track the rooms visited. Initialize the
-    // path indices to all be -1 (0 is a legitimate value so it can not be
-    // used to indicate an unvisited Room) and initialize the path count
-    // to 0 because we're just starting.
-    //
-    struct Path path = { {-1}, 0};
+// *****************************************************************************
+// 
+// rngSeed(struct Rng *rng, uint64_t seed, uint64_t stream)
+//
+// Purpose: Start a random number stream.
+//
+// *****************************************************************************
+//
+void rngSeed(struct Rng *rng, uint64_t seed, uint64_t stream) {
 
-    // Always start with START_ROOM. Keep looking until you find it.
-    //
-    i = 0;
-    do {
-        if(prooms[i]->type == START_ROOM) {
-            currRoom = prooms[i];
-        }
-        i++;
-    } while((currRoom == NULL) && (i < MAX_ROOMS));
+    uint64_t x;          // SplitMix64 state
 
-    // Start the journey. As long as the user has not reached the END ROOM,
-    // or as long as (s)he has not explored for too long without finding it
-    // (controlled by MAX_PATH), keep presenting rooms.
+    // Fold the stream number into the seed, then let SplitMix64 spread
+    // the result over the whole state so neighbouring streams look
+    // nothing alike.
     //
-    while((currRoom->type != END_ROOM) && (path.pathCount < MAX_PATH)) {
+    x = seed ^ (stream * 0xd1b54a32d192ed03ull);
+    rng->s[0] = splitMix64(&x);
+    rng->s[1] = splitMix64(&x);
+    rng->s[2] = splitMix64(&x);
+    rng->s[3] = splitMix64(&x);
 
-        // Display the current Room name.
-        //
-        printf("CURRENT LOCATION: %s\n", currRoom->name);
+}
 
-        //
-        // Display the adjacent ("CONNECTION") Rooms.
-        //
-        
-        printf("POSSIBLE CONNECTIONS:");
-        // The first connection will not be preceded by a comma. Make 
-        // sure this does not happen by initializing the conn counter 
-        // to 0.
-        //
-        conn = 0;
 
-        // Walk through the current Room's adj[] array to find adjacent
-        // room flags (1 = adjacent, 0 = not adjacent). When a flag is 
-        // found, look up the identical index in readRoomNames[] and
-        // present the Room name to the user as an adjacent Room.
-        //
-        for(x = 0; x < MAX_ROOMS; x++) {
-            if(currRoom->adj[x] == 1) {
-                if(conn == 0) {
-                    printf(" %s", readRoomNames[x]);  // first adj Room
-                } else {
-                    printf(", %s", readRoomNames[x]); // all others
-                }
-                conn++;
-            }
-        }
+// *****************************************************************************
+// 
+// rngNext(struct Rng *rng)
+//
+// Purpose: Draw 64 random bits (xoshiro256**).
+//
+// *****************************************************************************
+//
+uint64_t rngNext(struct Rng *rng) {
 
-        // Append a period to close out the adjacent room list, then
-        // prompt the user for an adjacent Room to visit.
-        //
-        printf(".\nWHERE TO? >");
+    uint64_t *s = rng->s;
+    uint64_t result;     // the output, taken before the state moves on
+    uint64_t t;          // holds s[1] << 17 while the state is mixed
 
-        // Read the user's Room input.
-        //
-        fgets(userInput, MAX_ROOM_CHARS, stdin);
+    result = s[1] * 5;
+    result = ((result << 7) | (result >> 57)) * 9;
 
-        // Remove trailing newline by replacing it with a null terminator.
-        //
-        userInputLen = strlen(userInput) - 1; 
-        if(userInput[userInputLen] == '\n') {
-            userInput[userInputLen] = '\0';
-        }
+    t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
 
-        // Did the user enter a valid adjacent Room name? First, look up
-        // the userInput string in readRoomNames[] and, if found, assign
-        // the index to userInputIdx...
-        //
-        for(x = 0; x < MAX_ROOMS; x++) {
-            if(strcmp(readRoomNames[x], userInput) == 0) {
-                userInputIdx = x;
-            }
-        }
+    return result;
 
-        // ...next, see if userInputIdx points to an adjacent room in the
-        // current Room's adj[] array (remember, the order of Rooms in
-        // readRoomNames[], prooms[], and each Room's adj[] array
-        // match). If the Room entered is adjacent to the current Room,
-        // make the new Room the current Room, add the Room's index to the
-        // path, and increment the path counter. Otherwise, start over
-        // prompting the user for an adjacent room using the existing
-        // current Room's data (don't change any path values. Wrong
-        // answers do not count as part of the journey).
-        //
-        if(currRoom->adj[userInputIdx] == 1) {
-            currRoom = prooms[userInputIdx];
-            path.pathIdxs[path.pathCount] = userInputIdx;
-            path.pathCount++;
-        } else {
-            printf("\nHUH? I DON'T UNDERSTAND THAT ROOM. TRY AGAIN.\n");
-        }
+}
 
-        // Pretty things up with a newline.
-        //
-        printf("\n");
-    }
 
-    // At this point, the user has either found the END ROOM or has run
-    // out of allowed steps. Figure out which and report accordingly. Note
-    // that if the path only contains one Room, report the steps as "STEP"
-    // (singular) and not "STEPS" (plural).
-    //
-    if(currRoom->type == END_ROOM) {
-        printf("YOU HAVE FOUND THE END ROOM. CONGRATULATIONS!\n");
-        printf("YOU TOOK %d STEP%s YOUR PATH TO VICTORY WAS:\n", path.pathCount, (path.pathCount > 1 ? "S." : "."));
+// *****************************************************************************
+// 
+// rngBounded(struct Rng *rng, uint32_t bound)
+//
+// Purpose: Draw a random number from 0 to bound-1.
+//
+// *****************************************************************************
+//
+uint32_t rngBounded(struct Rng *rng, uint32_t bound) {
 
-        // Print out the path that lead to the END ROOM.
-        //
-        for(i = 0; i < path.pathCount; i++) {
-            printf("%s\n", readRoomNames[path.pathIdxs[i]]);
+    uint64_t m;          // 32 random bits times bound
+    uint32_t low;        // low half of m
+    uint32_t threshold;  // low halves below this would bias the result
+
+    // Lemire's method: the high half of a 32x32 bit multiply is already
+    // a number in range. Only when the low half lands in the small
+    // biased sliver (less than 2^32 % bound) is another draw needed,
+    // and the division to find that sliver is only done then.
+    //
+    m = (rngNext(rng) >> 32) * (uint64_t) bound;
+    low = (uint32_t) m;
+    if(low < bound) {
+        threshold = -bound % bound;
+        while(low < threshold) {
+            m = (rngNext(rng) >> 32) * (uint64_t) bound;
+            low = (uint32_t) m;
         }
-    } else {
-        // The user ran out of allowed steps. Don't bother showing the
-        // path. They lost (and it's not required, I believe).
-        //
-        printf("YOU DIDN'T FIND THE END ROOM IN %d MOVES! SO SORRY.\n", MAX_PATH);
     }
 
-    return 0;
+    return (uint32_t) (m >> 32);
 
 }
 
 
 // *****************************************************************************
 // 
-// cleanRooms(struct Room *prooms[])
+// runWorkers(void *(*work)(void *), void *tasks, size_t taskSize,
+//            int numTasks)
 //
-// Free all pointers used in Room structs.
+// Purpose: Run a job on several threads at once.
 //
 // *****************************************************************************
 //
-void cleanRooms(struct Room *prooms[]) {
+void runWorkers(void *(*work)(void *), void *tasks, size_t taskSize,
+                int numTasks) {
 
-    int i;    // loop iterator
+    int t;                          // loop iterator
+    pthread_t threads[MAX_THREADS]; // one per worker
 
-    // Step through the prooms[] array of Room pointers and free the
-    // memory for each. Set the pointers to NULL afterward to finish them
-    // off properly.
+    // The calling thread takes the first task itself, so a single task
+    // never starts a thread at all.
     //
-    for(i = 0; i < MAX_ROOMS; i++) {
-      if(prooms[i] != NULL) {
-        free(prooms[i]);
-        prooms[i] = 0;
-      }
+    for(t = 1; t < numTasks; t++) {
+        if(pthread_create(&threads[t], NULL, work,
+                          (char *) tasks + t * taskSize) != 0) {
+            printf("Error starting worker thread: errno = %d\n", errno);
+            exit(1);
+        }
+    }
+
+    if(numTasks > 0) {
+        work(tasks);
+    }
+
+    for(t = 1; t < numTasks; t++) {
+        pthread_join(threads[t], NULL);
     }
 
 }
 
+
+// *****************************************************************************
+// 
+// printUsage(char *progName)
+//
+// Purpose: Print the command line options.
+//
+// *****************************************************************************
+//
+void printUsage(char *progName) {
+
+    printf("Usage: %s [options]\n", progName);
+    printf("  -r, --rooms N        number of Rooms in the world (default %d)\n",
+           DEFAULT_ROOMS);
+    printf("  -f, --format FMT     store a new world as \"text\" Room files\n"
+           "                       (default) or one \"binary\" world file\n");
+    printf("  -l, --load PATH      play an existing world (a Room file\n"
+           "                       directory or a binary world file)\n");
+    printf("  -e, --export DIR     also write the world out as text Room\n"
+           "                       files in DIR\n");
+    printf("  -t, --threads N      threads used to build, write and load\n"
+           "                       the world (default: one per processor)\n");
+    printf("  -d, --shards N       spread text Room files over N hashed\n"
+           "                       subdirectories with a manifest\n"
+           "                       (default 0: one flat directory)\n");
+    printf("  -L, --lazy           read text Room files as the player\n"
+           "                       reaches them instead of all up front\n"
+           "                       (ignored with --export, --serve,\n"
+           "                       --checkpoint and --resume)\n");
+    printf("  -s, --seed N         seed for building the world, so it can\n"
+           "                       be built again (default: the time)\n");
+    printf("  -g, --generator G    \"connected\" (default): every room can\n"
+           "                       be reached; \"classic\": %d random\n"
+           "                       connections per room\n", MIN_ADJ);
+    printf("  -m, --min-degree N   fewest connections per room for the\n"
+           "                       connected generator (default %d)\n",
+           MIN_ADJ);
+    printf("  -M, --max-degree N   most connections per room for the\n"
+           "                       connected generator (default %d)\n",
+           MAX_ADJ);
+    printf("  -b, --batch FILE     replay the sessions in FILE (\"-\" for\n"
+           "                       stdin), one per line of room names,\n"
+           "                       instead of playing\n");
+    printf("  -u, --serve SOCKET   serve games to any number of players\n"
+           "                       on a Unix domain socket until stopped\n"
+           "                       (Linux only)\n");
+    printf("  -C, --cache DIR      keep new worlds in DIR, keyed by seed,\n"
+           "                       rooms, generator and degrees, and map\n"
+           "                       a cached one instead of building it\n");
+    printf("  -P, --protocol P     \"text\" (default) for people, or\n"
+           "                       \"json\" for programs: moves by room\n"
+           "                       index, one JSON line per turn\n");
+    printf("  -k, --checkpoint F   save the game to F when SAVE is typed\n"
+           "                       or on SIGTERM\n");
+    printf("  -K, --resume F       pick up the game saved in F (and keep\n"
+           "                       saving there unless --checkpoint is\n"
+           "                       given)\n");
+    printf("  -j, --journal F      append every move of every game\n"
+           "                       (rejected ones too) to the binary\n"
+           "                       journal F\n");
+    printf("  -x, --journal-read F decode the journal F and print what\n"
+           "                       it holds\n");
+    printf("  -a, --analyze N      simulate N random and N greedy players\n"
+           "                       per world and report win rates and\n"
+           "                       path lengths instead of playing\n");
+    printf("  -w, --worlds N       build and analyze N worlds (seeds\n"
+           "                       --seed, --seed+1, ...; default 1)\n");
+    printf("  -B, --bench          time generating, writing, loading and\n"
+           "                       playing worlds, and print the results\n"
+           "                       as CSV (seed %d unless --seed is given)\n",
+           BENCH_SEED);
+    printf("  -R, --bench-rooms L  room counts to benchmark (default\n"
+           "                       %s)\n", BENCH_ROOMS);
+    printf("  -D, --bench-degrees L\n"
+           "                       min-max degrees to benchmark (default\n"
+           "                       %s)\n", BENCH_DEGREES);
+    printf("  -J, --bench-json     print benchmark results as JSON\n");
+    printf("  -S, --stats FMT      on exit, dump phase timings and I/O\n"
+           "                       counters as \"json\" or \"prom\"\n"
+           "                       (Prometheus text format)\n");
+    printf("  -F, --stats-file F   dump the stats to F instead of stderr\n");
+    printf("  -h, --help           show this help\n");
+
+}